@@ -0,0 +1,111 @@
+// Cost of mapping a verb to its handler, the old linear scan over a table
+// of std::string names against dispatch::PerfectHash.
+//
+//   g++ -std=c++14 -O2 -I../src DispatchBench.cpp -o dispatchbench
+//   ./dispatchbench
+//
+// The verb set mirrors CommanList in src/Ftp.cpp.
+
+#include "Dispatch.hpp"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct Entry
+{
+    constexpr Entry( const char* n ) :
+        name { n },
+        key  { fcpp::dispatch::VerbKey( n ) }
+    {
+    }
+
+    const char* name;
+    uint64_t    key;
+};
+
+constexpr Entry verbs[] {
+    "USER", "PASS", "ABOR", "ALLO", "APPE", "CWD",  "DELE", "EPSV",
+    "FEAT", "HASH", "LIST", "MKD",  "MLSD", "MLST", "MODE", "NLST",
+    "NOOP", "OPTS", "PASV", "PWD",  "QUIT", "REST", "RETR", "RMD",
+    "SITE", "SIZE", "STOR", "TYPE", "XCRC", "XMD5", "XSHA256",
+};
+
+constexpr auto hash = fcpp::dispatch::MakePerfectHash< 8 >( verbs );
+
+// what ProcessCommand did before: copy each entry, compare strings
+struct LegacyEntry
+{
+    std::string name;
+    int         index;
+};
+
+volatile int sink;
+
+template< typename F >
+double NanosPerLookup( F lookup, const std::vector< std::string >& input,
+                       int rounds )
+{
+    auto start = Clock::now();
+    for( int r = 0; r < rounds; ++r )
+    {
+        for( const auto& verb : input )
+        {
+            sink = lookup( verb );
+        }
+    }
+    std::chrono::duration< double, std::nano > elapsed = Clock::now() - start;
+    return elapsed.count() / ( (double)rounds * input.size() );
+}
+
+} // namespace
+
+int main()
+{
+    std::vector< LegacyEntry > legacy;
+    for( size_t i = 0; i < sizeof( verbs ) / sizeof( verbs[ 0 ] ); ++i )
+    {
+        legacy.push_back( LegacyEntry { verbs[ i ].name, (int)i } );
+    }
+
+    // a typical session mix plus a miss
+    std::vector< std::string > input {
+        "USER", "PASS", "PWD", "TYPE", "PASV", "LIST", "CWD", "SIZE",
+        "PASV", "RETR", "PASV", "STOR", "NOOP", "XFOO", "QUIT", "stor",
+    };
+
+    const int rounds = 1000000;
+
+    auto linear = NanosPerLookup( [ &legacy ]( const std::string& verb ) {
+        for( auto entry : legacy )
+        {
+            if( verb == entry.name )
+            {
+                return entry.index;
+            }
+        }
+        return -1;
+    }, input, rounds );
+
+    auto perfect = NanosPerLookup( []( const std::string& verb ) {
+        auto key = fcpp::dispatch::VerbKey( verb.data(), verb.size() );
+        auto index = hash.Find( key );
+        if( index == fcpp::dispatch::PerfectHash< 8 >::empty ||
+            verbs[ index ].key != key )
+        {
+            return -1;
+        }
+        return (int)index;
+    }, input, rounds );
+
+    std::cout << "verb dispatch, " << input.size() * rounds << " lookups\n"
+              << "  linear scan  : " << linear << " ns/lookup\n"
+              << "  perfect hash : " << perfect << " ns/lookup ("
+              << linear / perfect << "x)\n";
+}
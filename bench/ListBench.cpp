@@ -0,0 +1,157 @@
+// Directory listing throughput, the pre-statx LIST loop against
+// Directory::Render.
+//
+// Build with (one command line):
+//   g++ -std=c++14 -O2 -I../src ListBench.cpp ../src/Log.cpp -o listbench
+//       -lpthread
+//   ./listbench [entries]
+//
+// Both variants list the same synthetic directory into one end of a
+// socketpair that a thread keeps draining, like a data connection would.
+
+#include "Directory.hpp"
+#include <boost/format.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// the listing loop as it was before: stat() per name, two boost::format
+// calls per line and one write per entry
+void LegacyList( const std::string& path, int out )
+{
+    DIR* dir = ::opendir( path.c_str() );
+    int dfd = ::dirfd( dir );
+    char timebuf[ 80 ];
+    struct stat statbuf;
+
+    struct dirent *entry;
+    while( ( entry = ::readdir( dir ) ) )
+    {
+        if( -1 == ::fstatat( dfd, entry->d_name, &statbuf, 0 ) )
+        {
+            continue;
+        }
+
+        auto rawtime = statbuf.st_mtime;
+        strftime( timebuf, sizeof( timebuf ), "%b %d %H:%M",
+                  gmtime( &rawtime ) );
+
+        std::string perms;
+        for( int i = 6; i >= 0; i -= 3 )
+        {
+            auto current = ( ( statbuf.st_mode & ALLPERMS ) >> i ) & 0x7;
+            perms += ( boost::format( "%c%c%c" )
+                                      % ( ( current & 4 ) ? 'r' : '-' )
+                                      % ( ( current & 2 ) ? 'w' : '-' )
+                                      % ( ( current & 1 ) ? 'x' : '-' )
+                     ).str();
+        }
+
+        std::string str = (
+                boost::format( "%c%s %5ld %4d %4d %8ld %s %s\r\n" )
+                                % ( entry->d_type == DT_DIR ? 'd' : '-' )
+                                % perms
+                                % statbuf.st_nlink
+                                % statbuf.st_uid
+                                % statbuf.st_gid
+                                % statbuf.st_size
+                                % timebuf
+                                % entry->d_name
+                           ).str();
+        if( ::write( out, str.data(), str.size() ) < 0 )
+        {
+            break;
+        }
+    }
+
+    ::closedir( dir );
+}
+
+void NewList( const std::string& path, int out )
+{
+    fcpp::Directory dir { AT_FDCWD, path.c_str() };
+
+    std::string buf;
+    buf.reserve( fcpp::Directory::flushSize + 4096 );
+    dir.Render( buf, fcpp::Directory::flushSize, [ out ]( std::string& data ) {
+        for( size_t done = 0; done < data.size(); )
+        {
+            auto n = ::write( out, data.data() + done, data.size() - done );
+            if( n < 0 )
+            {
+                break;
+            }
+            done += n;
+        }
+        data.clear();
+    } );
+}
+
+template< typename F >
+double EntriesPerSecond( F list, const std::string& path, size_t entries,
+                         int rounds )
+{
+    int fds[ 2 ];
+    ::socketpair( AF_UNIX, SOCK_STREAM, 0, fds );
+    std::thread drain( [ &fds ]() {
+        char buf[ 1 << 16 ];
+        while( ::read( fds[ 1 ], buf, sizeof( buf ) ) > 0 )
+        {
+        }
+    } );
+
+    list( path, fds[ 0 ] ); // warm the dentry/inode caches
+    auto start = Clock::now();
+    for( int i = 0; i < rounds; ++i )
+    {
+        list( path, fds[ 0 ] );
+    }
+    std::chrono::duration< double > elapsed = Clock::now() - start;
+
+    ::shutdown( fds[ 0 ], SHUT_WR );
+    drain.join();
+    ::close( fds[ 0 ] );
+    ::close( fds[ 1 ] );
+
+    return entries * rounds / elapsed.count();
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    size_t entries = argc > 1 ? std::strtoul( argv[ 1 ], nullptr, 10 ) : 200000;
+
+    char tmpl[] = "/tmp/listbench.XXXXXX";
+    std::string path = ::mkdtemp( tmpl );
+    for( size_t i = 0; i < entries; ++i )
+    {
+        auto name = path + "/file_" + std::to_string( i ) + ".dat";
+        ::close( ::open( name.c_str(), O_CREAT | O_WRONLY, 0644 ) );
+    }
+
+    const int rounds = 5;
+    auto legacy = EntriesPerSecond( LegacyList, path, entries, rounds );
+    auto current = EntriesPerSecond( NewList, path, entries, rounds );
+
+    std::cout << entries << " entries, " << rounds << " rounds\n"
+              << "  legacy LIST : " << (uint64_t)legacy << " entries/s\n"
+              << "  Render      : " << (uint64_t)current << " entries/s ("
+              << current / legacy << "x)\n";
+
+    std::string cleanup = "rm -rf " + path;
+    return std::system( cleanup.c_str() );
+}
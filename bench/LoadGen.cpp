@@ -0,0 +1,649 @@
+// Load generator: N concurrent control sessions driving a weighted mix of
+// commands over loopback, reporting commands/s, latency percentiles and
+// data throughput.
+//
+// Build with (one command line):
+//   g++ -std=c++14 -O2 -I../src LoadGen.cpp
+//       $(ls ../src/*.cpp | grep -v main.cpp) -o loadgen -lz -lcrypto
+//       -lpthread
+//   ./loadgen [--sessions=N] [--seconds=N] [--mix=VERB:WEIGHT,...]
+//             [--file-size=BYTES] [--server-threads=N]
+//             [--port=N] [--host=ADDR]
+//
+// Without --port the server is started in-process on port 18021 with a
+// scratch root, with --port an already running server is measured
+// (anonymous login). The mix names operations: login (USER+PASS), pwd, cwd
+// (CWD into a directory and back), size, list, retr and stor; list, retr
+// and stor each take a PASV. The default is
+// pwd:20,cwd:20,size:20,list:10,retr:10,stor:5,login:5.
+//
+// Latency is the time from sending a command to its first reply line, for
+// transfers that is the 150/125 reply, the transfer itself is accounted in
+// the MB/s figure.
+
+#include "Config.hpp"
+#include "Context.hpp"
+#include "IoServicePool.hpp"
+#include "Log.hpp"
+#include "Server.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+enum Verb { USER, PASS, PWD, CWD, SIZE, PASV, LIST, RETR, STOR, verbCount };
+const char* const verbNames[] {
+    "USER", "PASS", "PWD", "CWD", "SIZE", "PASV", "LIST", "RETR", "STOR"
+};
+
+enum Op { Login, Pwd, Cwd, Size, List, Retr, Stor, opCount };
+const char* const opNames[] {
+    "login", "pwd", "cwd", "size", "list", "retr", "stor"
+};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    uint16_t    port = 0;       // 0 = start the server in-process
+    size_t      sessions = 32;
+    size_t      seconds = 10;
+    size_t      fileSize = 1 << 20;
+    size_t      serverThreads = 2;
+    unsigned    mix[ opCount ] { 5, 20, 20, 20, 10, 10, 5 };
+};
+
+// per session, merged at the end
+struct Stats
+{
+    std::vector< uint32_t > latency[ verbCount ]; // ns
+    uint64_t commands = 0;
+    uint64_t errors = 0;
+    uint64_t transfers = 0;
+    uint64_t bytes = 0;
+};
+
+const std::string fileName = "loadgen.bin";
+const std::string dirName  = "loadgen.d";
+
+[[noreturn]] void Fail( const std::string& what )
+{
+    throw std::runtime_error { what + ": " + ::strerror( errno ) };
+}
+
+int Connect( const std::string& host, uint16_t port )
+{
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons( port );
+    if( 1 != ::inet_pton( AF_INET, host.c_str(), &addr.sin_addr ) )
+    {
+        throw std::invalid_argument { "invalid address '" + host + "'" };
+    }
+
+    int fd = ::socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( -1 == fd )
+    {
+        Fail( "socket" );
+    }
+    int one = 1;
+    ::setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    if( -1 == ::connect( fd, (sockaddr*)&addr, sizeof( addr ) ) )
+    {
+        ::close( fd );
+        Fail( "connect" );
+    }
+    return fd;
+}
+
+void SendAll( int fd, const char* data, size_t len )
+{
+    while( len > 0 )
+    {
+        auto n = ::send( fd, data, len, MSG_NOSIGNAL );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            Fail( "send" );
+        }
+        data += n;
+        len  -= n;
+    }
+}
+
+// one blocking control connection
+class Client
+{
+public:
+    Client( const std::string& host, uint16_t port ) :
+        host_ ( host ),
+        fd_   ( Connect( host, port ) )
+    {
+        Reply(); // 220
+    }
+
+    ~Client()
+    {
+        ::close( fd_ );
+    }
+
+    Client( const Client& ) = delete;
+    Client& operator=( const Client& ) = delete;
+
+    void Send( const std::string& line )
+    {
+        auto data = line + "\r\n";
+        SendAll( fd_, data.data(), data.size() );
+    }
+
+    // reads one complete (possibly multi-line) reply, returns its code
+    int Reply()
+    {
+        for( ;; )
+        {
+            auto line = Line();
+            // 'ddd ' ends a reply, 'ddd-' and indented lines continue it
+            if( line.size() >= 4 && line[ 3 ] == ' ' &&
+                std::all_of( line.begin(), line.begin() + 3, ::isdigit ) )
+            {
+                last_ = line;
+                return std::atoi( line.c_str() );
+            }
+        }
+    }
+
+    // sends 'line' and returns the code of the first reply
+    int Command( const std::string& line, Stats& stats, Verb verb )
+    {
+        auto start = Clock::now();
+        Send( line );
+        int code = Reply();
+        auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(
+                                            Clock::now() - start ).count();
+        stats.latency[ verb ].push_back(
+                    (uint32_t)std::min< int64_t >( ns, UINT32_MAX ) );
+        ++stats.commands;
+        if( code >= 400 )
+        {
+            ++stats.errors;
+        }
+        return code;
+    }
+
+    // PASV and connect, returns the data socket or -1
+    int Passive( Stats& stats )
+    {
+        if( 227 != Command( "PASV", stats, PASV ) )
+        {
+            return -1;
+        }
+
+        unsigned h[ 4 ], p1, p2;
+        auto paren = last_.find( '(' );
+        if( paren == std::string::npos ||
+            6 != std::sscanf( last_.c_str() + paren, "(%u,%u,%u,%u,%u,%u)",
+                              &h[ 0 ], &h[ 1 ], &h[ 2 ], &h[ 3 ], &p1, &p2 ) )
+        {
+            ++stats.errors;
+            return -1;
+        }
+        return Connect( host_, (uint16_t)( p1 * 256 + p2 ) );
+    }
+
+private:
+    std::string Line()
+    {
+        for( ;; )
+        {
+            auto eol = buf_.find( "\r\n" );
+            if( eol != std::string::npos )
+            {
+                auto line = buf_.substr( 0, eol );
+                buf_.erase( 0, eol + 2 );
+                return line;
+            }
+
+            char chunk[ 4096 ];
+            auto n = ::recv( fd_, chunk, sizeof( chunk ), 0 );
+            if( -1 == n && errno == EINTR )
+            {
+                continue;
+            }
+            if( n <= 0 )
+            {
+                throw std::runtime_error { "control connection closed" };
+            }
+            buf_.append( chunk, n );
+        }
+    }
+
+    const std::string host_;
+    const int         fd_;
+    std::string       buf_;
+    std::string       last_;
+};
+
+uint64_t Drain( int fd )
+{
+    char buf[ 1 << 16 ];
+    uint64_t total = 0;
+    for( ;; )
+    {
+        auto n = ::recv( fd, buf, sizeof( buf ), 0 );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( n <= 0 )
+        {
+            return total;
+        }
+        total += n;
+    }
+}
+
+// runs a data command on a fresh PASV connection
+void Transfer( Client& client, Stats& stats, Verb verb,
+               const std::string& line, const std::string& upload )
+{
+    int data = client.Passive( stats );
+    if( -1 == data )
+    {
+        return;
+    }
+
+    int code = client.Command( line, stats, verb );
+    if( code == 150 || code == 125 )
+    {
+        if( verb == STOR )
+        {
+            SendAll( data, upload.data(), upload.size() );
+            stats.bytes += upload.size();
+        }
+        else
+        {
+            stats.bytes += Drain( data );
+        }
+        ::close( data );
+        data = -1;
+
+        if( client.Reply() / 100 == 2 )
+        {
+            ++stats.transfers;
+        }
+        else
+        {
+            ++stats.errors;
+        }
+    }
+
+    if( data != -1 )
+    {
+        ::close( data );
+    }
+}
+
+void LogIn( Client& client, Stats& stats )
+{
+    client.Command( "USER anonymous", stats, USER );
+    client.Command( "PASS loadgen@", stats, PASS );
+}
+
+void RunSession( const Options& opt, size_t index, Clock::time_point end,
+                 const std::string& upload, Stats& stats )
+{
+    std::mt19937 rng { (unsigned)index };
+    std::discrete_distribution< int > pick ( std::begin( opt.mix ),
+                                             std::end( opt.mix ) );
+    const auto stored = "loadgen." + std::to_string( index ) + ".bin";
+
+    Client client { opt.host, opt.port };
+    LogIn( client, stats );
+
+    while( Clock::now() < end )
+    {
+        switch( pick( rng ) )
+        {
+        case Login:
+            LogIn( client, stats );
+            break;
+        case Pwd:
+            client.Command( "PWD", stats, PWD );
+            break;
+        case Cwd:
+            client.Command( "CWD " + dirName, stats, CWD );
+            client.Command( "CWD ..", stats, CWD );
+            break;
+        case Size:
+            client.Command( "SIZE " + fileName, stats, SIZE );
+            break;
+        case List:
+            Transfer( client, stats, LIST, "LIST", upload );
+            break;
+        case Retr:
+            Transfer( client, stats, RETR, "RETR " + fileName, upload );
+            break;
+        case Stor:
+            Transfer( client, stats, STOR, "STOR " + stored, upload );
+            break;
+        }
+    }
+
+    client.Send( "QUIT" );
+}
+
+// the files the mix works on
+void Prepare( const Options& opt, const std::string& upload )
+{
+    Stats stats;
+    Client client { opt.host, opt.port };
+    LogIn( client, stats );
+    client.Command( "MKD " + dirName, stats, CWD );
+    Transfer( client, stats, STOR, "STOR " + fileName, upload );
+    if( stats.transfers != 1 )
+    {
+        throw std::runtime_error { "could not upload " + fileName };
+    }
+    client.Send( "QUIT" );
+}
+
+unsigned ToNumber( const std::string& value )
+{
+    size_t pos = 0;
+    auto n = std::stoul( value, &pos );
+    if( pos != value.size() )
+    {
+        throw std::invalid_argument { "invalid number '" + value + "'" };
+    }
+    return n;
+}
+
+Options Parse( int argc, char* argv[] )
+{
+    Options opt;
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string arg { argv[ i ] };
+        auto eq = arg.find( '=' );
+        if( arg.compare( 0, 2, "--" ) != 0 || eq == std::string::npos )
+        {
+            throw std::invalid_argument { "unknown argument '" + arg + "'" };
+        }
+        auto name  = arg.substr( 2, eq - 2 );
+        auto value = arg.substr( eq + 1 );
+
+        if( name == "host" )
+        {
+            opt.host = value;
+        }
+        else if( name == "port" )
+        {
+            opt.port = (uint16_t)ToNumber( value );
+        }
+        else if( name == "sessions" )
+        {
+            opt.sessions = std::max( 1u, ToNumber( value ) );
+        }
+        else if( name == "seconds" )
+        {
+            opt.seconds = std::max( 1u, ToNumber( value ) );
+        }
+        else if( name == "file-size" )
+        {
+            opt.fileSize = ToNumber( value );
+        }
+        else if( name == "server-threads" )
+        {
+            opt.serverThreads = std::max( 1u, ToNumber( value ) );
+        }
+        else if( name == "mix" )
+        {
+            std::fill( std::begin( opt.mix ), std::end( opt.mix ), 0 );
+            for( size_t pos = 0; pos < value.size(); )
+            {
+                auto comma = std::min( value.find( ',', pos ), value.size() );
+                auto item  = value.substr( pos, comma - pos );
+                auto colon = item.find( ':' );
+                auto op = std::find( std::begin( opNames ),
+                                     std::end( opNames ),
+                                     item.substr( 0, colon ) );
+                if( op == std::end( opNames ) || colon == std::string::npos )
+                {
+                    throw std::invalid_argument {
+                        "invalid mix entry '" + item + "'"
+                    };
+                }
+                opt.mix[ op - std::begin( opNames ) ] =
+                                        ToNumber( item.substr( colon + 1 ) );
+                pos = comma + 1;
+            }
+        }
+        else
+        {
+            throw std::invalid_argument { "unknown option '" + arg + "'" };
+        }
+    }
+    return opt;
+}
+
+double Percentile( const std::vector< uint32_t >& sorted, double p )
+{
+    if( sorted.empty() )
+    {
+        return 0;
+    }
+    auto i = std::min( sorted.size() - 1, size_t( p * sorted.size() ) );
+    return sorted[ i ] / 1000.0;
+}
+
+void PrintLatency( const char* name, std::vector< uint32_t >& ns )
+{
+    std::sort( ns.begin(), ns.end() );
+    std::printf( "  %-6s %10zu  %10.1f %10.1f %10.1f\n", name, ns.size(),
+                 Percentile( ns, 0.5 ), Percentile( ns, 0.99 ),
+                 Percentile( ns, 0.999 ) );
+}
+
+int RemoveEntry( const char* path, const struct stat*, int, FTW* )
+{
+    return ::remove( path );
+}
+
+// a directory under /tmp, removed with everything in it when done
+class ScratchDir
+{
+public:
+    ScratchDir()
+    {
+        if( ! ::mkdtemp( path_ ) )
+        {
+            Fail( "mkdtemp" );
+        }
+    }
+
+    ~ScratchDir()
+    {
+        ::nftw( path_, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS );
+    }
+
+    ScratchDir( const ScratchDir& ) = delete;
+    ScratchDir& operator=( const ScratchDir& ) = delete;
+
+    const char* path() const
+    {
+        return path_;
+    }
+
+private:
+    char path_[ 20 ] = "/tmp/loadgen.XXXXXX";
+};
+
+fcpp::Config ServerConfig( uint16_t port, const char* root, size_t threads )
+{
+    auto portArg    = "--port=" + std::to_string( port );
+    auto rootArg    = std::string { "--root=" } + root;
+    auto threadsArg = "--threads=" + std::to_string( threads );
+    const char* args[] {
+        "loadgen", portArg.c_str(), rootArg.c_str(), threadsArg.c_str(),
+        "--log-level=error"
+    };
+    return fcpp::Config::Parse( 5, args );
+}
+
+// The server on a scratch root, run by a thread of its own. Whatever
+// happens to the run, the destructor stops and joins the server and
+// removes the root.
+class InProcessServer
+{
+public:
+    InProcessServer( uint16_t port, size_t threads ) :
+        context_ { ServerConfig( port, root_.path(), threads ) },
+        pool_    { threads, false },
+        server_  { context_, pool_, pool_.at( 0 ) },
+        thread_  { [ this ]() { pool_.run(); } }
+    {
+        fcpp::log::threshold = context_.config.logLevel;
+    }
+
+    ~InProcessServer()
+    {
+        // transfer jobs post to the io_services and close sockets on them,
+        // so they finish first
+        context_.transfers.Stop();
+        pool_.stop();
+        thread_.join();
+    }
+
+    InProcessServer( const InProcessServer& ) = delete;
+    InProcessServer& operator=( const InProcessServer& ) = delete;
+
+private:
+    ScratchDir          root_;
+    fcpp::Context       context_;
+    fcpp::IoServicePool pool_;
+    fcpp::TcpServer     server_;
+    std::thread         thread_;
+};
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    try
+    {
+        auto opt = Parse( argc, argv );
+        ::signal( SIGPIPE, SIG_IGN );
+
+        // in-process server on a scratch root
+        fcpp::log::Flusher logFlusher;
+        std::unique_ptr< InProcessServer > server;
+        if( 0 == opt.port )
+        {
+            opt.port = 18021;
+            server.reset( new InProcessServer { opt.port,
+                                                opt.serverThreads } );
+        }
+
+        const std::string upload ( opt.fileSize, 'x' );
+        Prepare( opt, upload );
+
+        std::vector< Stats > stats ( opt.sessions );
+        std::vector< std::thread > sessions;
+        std::atomic< size_t > failed { 0 };
+
+        auto start = Clock::now();
+        auto end   = start + std::chrono::seconds( opt.seconds );
+        for( size_t i = 0; i < opt.sessions; ++i )
+        {
+            sessions.emplace_back( [ &, i ]() {
+                try
+                {
+                    RunSession( opt, i, end, upload, stats[ i ] );
+                }
+                catch( std::exception& ex )
+                {
+                    if( 0 == failed++ )
+                    {
+                        std::cerr << "session failed: " << ex.what() << "\n";
+                    }
+                }
+            } );
+        }
+        for( auto& t : sessions )
+        {
+            t.join();
+        }
+        std::chrono::duration< double > elapsed = Clock::now() - start;
+
+        Stats total;
+        for( auto& s : stats )
+        {
+            for( size_t v = 0; v < verbCount; ++v )
+            {
+                total.latency[ v ].insert( total.latency[ v ].end(),
+                                           s.latency[ v ].begin(),
+                                           s.latency[ v ].end() );
+            }
+            total.commands  += s.commands;
+            total.errors    += s.errors;
+            total.transfers += s.transfers;
+            total.bytes     += s.bytes;
+        }
+
+        std::vector< uint32_t > all;
+        for( const auto& l : total.latency )
+        {
+            all.insert( all.end(), l.begin(), l.end() );
+        }
+
+        std::printf( "%zu sessions, %.1f s, %s server\n", opt.sessions,
+                     elapsed.count(), server ? "in-process" : "external" );
+        std::printf( "  commands   %llu (%.0f/s), %llu error replies, "
+                     "%zu failed sessions\n",
+                     (unsigned long long)total.commands,
+                     total.commands / elapsed.count(),
+                     (unsigned long long)total.errors, failed.load() );
+        std::printf( "  transfers  %llu, %.1f MB/s\n",
+                     (unsigned long long)total.transfers,
+                     total.bytes / elapsed.count() / ( 1 << 20 ) );
+        std::printf( "  latency us      count         p50        p99"
+                     "       p999\n" );
+        PrintLatency( "all", all );
+        for( size_t v = 0; v < verbCount; ++v )
+        {
+            if( ! total.latency[ v ].empty() )
+            {
+                PrintLatency( verbNames[ v ], total.latency[ v ] );
+            }
+        }
+    }
+    catch( std::exception& ex )
+    {
+        std::cerr << ex.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+// Per-command CPU path primitives on synthetic input, with Google Benchmark.
+//
+// Build with (one command line):
+//   g++ -std=c++14 -O2 -I../src MicroBench.cpp ../src/Utils.cpp
+//       ../src/Log.cpp ../src/Metrics.cpp -o microbench -lbenchmark -lpthread
+//   ./microbench [--benchmark_filter=REGEX]
+//
+// Where a primitive replaced an older implementation the old one is kept
+// here as a Legacy* baseline. The Render benchmarks list scratch
+// directories of up to 100k entries, created fresh on first use under
+// /tmp/fcpp-microbench.* and removed when the program exits; a run that
+// is killed leaves them behind, for rm -rf.
+
+#include "Command.hpp"
+#include "Directory.hpp"
+#include "Metrics.hpp"
+#include "ReplyQueue.hpp"
+#include "Utils.hpp"
+#include <benchmark/benchmark.h>
+#include <boost/format.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+// a pipelined burst of 'count' commands whose arguments are 'argLen' long
+std::string Commands( size_t count, size_t argLen )
+{
+    const char* const verbs[] { "RETR", "SIZE", "CWD", "STOR", "MLST" };
+    std::string arg ( argLen, 'a' );
+
+    std::string out;
+    for( size_t i = 0; i < count; ++i )
+    {
+        out += verbs[ i % 5 ];
+        out += ' ';
+        out += arg;
+        out += "\r\n";
+    }
+    return out;
+}
+
+// Command( std::string ) as it was before the in-place parser
+struct LegacyCommand
+{
+    explicit LegacyCommand( std::string src )
+    {
+        fcpp::StringRepl( src, "\r\n", "" );
+
+        auto pos = src.find( " " );
+        if( pos != std::string::npos )
+        {
+            command = src.substr( 0, pos );
+            arg     = src.substr( pos + 1 );
+        }
+        else
+        {
+            command = src;
+        }
+    }
+
+    std::string command;
+    std::string arg;
+};
+
+void LegacyParse( benchmark::State& state )
+{
+    auto line = Commands( 1, state.range( 0 ) );
+    for( auto _ : state )
+    {
+        LegacyCommand cmd { line };
+        benchmark::DoNotOptimize( cmd.arg.data() );
+    }
+    state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( LegacyParse )->Arg( 8 )->Arg( 256 )->Arg( 4000 );
+
+void CommandReaderParse( benchmark::State& state )
+{
+    // as many commands as fit one receive buffer
+    const size_t argLen = state.range( 0 );
+    const size_t count  = std::max< size_t >(
+            1, fcpp::CommandReader::maxLineLength / ( argLen + 8 ) );
+    const auto input = Commands( count, argLen );
+
+    fcpp::CommandReader reader;
+    fcpp::Command cmd;
+    for( auto _ : state )
+    {
+        auto buf = reader.Prepare();
+        std::memcpy( boost::asio::buffer_cast< char* >( buf ), input.data(),
+                     input.size() );
+        reader.Commit( input.size() );
+        while( reader.Next( cmd ) == fcpp::CommandReader::Status::Ready )
+        {
+            benchmark::DoNotOptimize( cmd.arg.data() );
+        }
+    }
+    state.SetItemsProcessed( state.iterations() * count );
+}
+BENCHMARK( CommandReaderParse )->Arg( 8 )->Arg( 256 )->Arg( 4000 );
+
+void StringRepl( benchmark::State& state )
+{
+    // the old PrintCommand escaping of a multi-line reply
+    std::string reply;
+    while( reply.size() < (size_t)state.range( 0 ) )
+    {
+        reply += " type=file;size=1234;modify=20240101000000; name\r\n";
+    }
+
+    for( auto _ : state )
+    {
+        auto copy = reply;
+        fcpp::StringRepl( copy, "\r", "<CR>" );
+        fcpp::StringRepl( copy, "\n", "<LF>" );
+        benchmark::DoNotOptimize( copy.data() );
+    }
+    state.SetBytesProcessed( state.iterations() * reply.size() );
+}
+BENCHMARK( StringRepl )->Arg( 64 )->Arg( 4096 );
+
+fcpp::EntryStat SyntheticStat( size_t i )
+{
+    fcpp::EntryStat st {};
+    st.ino   = i;
+    st.mode  = ( i % 8 ? S_IFREG | 0644 : S_IFDIR | 0755 );
+    st.nlink = 1;
+    st.uid   = 1000;
+    st.gid   = 1000;
+    st.size  = i * 4099;
+    st.mtime = 1700000000 + i * 61;
+    return st;
+}
+
+// the old permissions2string, three boost::format calls per entry
+void LegacyPermissions( benchmark::State& state )
+{
+    size_t i = 0;
+    for( auto _ : state )
+    {
+        auto mode = SyntheticStat( i++ ).mode;
+        std::string perms;
+        for( int shift = 6; shift >= 0; shift -= 3 )
+        {
+            auto current = ( ( mode & ALLPERMS ) >> shift ) & 0x7;
+            perms += ( boost::format( "%c%c%c" )
+                                      % ( ( current & 4 ) ? 'r' : '-' )
+                                      % ( ( current & 2 ) ? 'w' : '-' )
+                                      % ( ( current & 1 ) ? 'x' : '-' )
+                     ).str();
+        }
+        benchmark::DoNotOptimize( perms.data() );
+    }
+}
+BENCHMARK( LegacyPermissions );
+
+void ListEntry( benchmark::State& state )
+{
+    std::string out;
+    out.reserve( 4096 );
+    size_t i = 0;
+    for( auto _ : state )
+    {
+        out.clear();
+        fcpp::AppendListEntry( out, SyntheticStat( i++ ), "some-file.tar.gz",
+                               16 );
+        benchmark::DoNotOptimize( out.data() );
+    }
+}
+BENCHMARK( ListEntry );
+
+void FactsEntry( benchmark::State& state )
+{
+    std::string out;
+    out.reserve( 4096 );
+    size_t i = 0;
+    for( auto _ : state )
+    {
+        out.clear();
+        auto st = SyntheticStat( i++ );
+        fcpp::AppendFacts( out, fcpp::mlst::Default, &st, DT_UNKNOWN,
+                           "some-file.tar.gz", 16 );
+        benchmark::DoNotOptimize( out.data() );
+    }
+}
+BENCHMARK( FactsEntry );
+
+// reply building as done in pasv/pwd/mkd, against plain appends
+void PasvReplyFormat( benchmark::State& state )
+{
+    unsigned char ip[ 4 ] { 127, 0, 0, 1 };
+    for( auto _ : state )
+    {
+        auto reply = ( boost::format(
+                            "227 entering passive mode (%d,%d,%d,%d,%d,%d)" )
+                       % (int)ip[0] % (int)ip[1] % (int)ip[2] % (int)ip[3]
+                       % 117 % 42 ).str();
+        benchmark::DoNotOptimize( reply.data() );
+    }
+}
+BENCHMARK( PasvReplyFormat );
+
+void PasvReplySnprintf( benchmark::State& state )
+{
+    unsigned char ip[ 4 ] { 127, 0, 0, 1 };
+    for( auto _ : state )
+    {
+        char reply[ 64 ];
+        int len = std::snprintf( reply, sizeof( reply ),
+                        "227 entering passive mode (%d,%d,%d,%d,%d,%d)",
+                        ip[0], ip[1], ip[2], ip[3], 117, 42 );
+        std::string str ( reply, len );
+        benchmark::DoNotOptimize( str.data() );
+    }
+}
+BENCHMARK( PasvReplySnprintf );
+
+void PwdReplyFormat( benchmark::State& state )
+{
+    std::string cwd = "/srv/ftp/" + std::string( state.range( 0 ), 'd' );
+    for( auto _ : state )
+    {
+        auto reply = ( boost::format( "257 \"%s\"" ) % cwd ).str();
+        benchmark::DoNotOptimize( reply.data() );
+    }
+}
+BENCHMARK( PwdReplyFormat )->Arg( 16 )->Arg( 1024 );
+
+void PwdReplyAppend( benchmark::State& state )
+{
+    std::string cwd = "/srv/ftp/" + std::string( state.range( 0 ), 'd' );
+    for( auto _ : state )
+    {
+        std::string reply = "257 \"";
+        reply += cwd;
+        reply += '"';
+        benchmark::DoNotOptimize( reply.data() );
+    }
+}
+BENCHMARK( PwdReplyAppend )->Arg( 16 )->Arg( 1024 );
+
+void MkdReplyFormat( benchmark::State& state )
+{
+    std::string cwd = "/srv/ftp/upload";
+    std::string arg ( state.range( 0 ), 'n' );
+    for( auto _ : state )
+    {
+        auto reply = ( boost::format( "257 \"%s%s%s\" directory created" )
+                                      % cwd % ( cwd == "/" ? "" : "/" )
+                                      % arg ).str();
+        benchmark::DoNotOptimize( reply.data() );
+    }
+}
+BENCHMARK( MkdReplyFormat )->Arg( 16 )->Arg( 1024 );
+
+int RemoveEntry( const char* path, const struct stat*, int, FTW* )
+{
+    return ::remove( path );
+}
+
+// Scratch directories holding a given number of empty files, each made
+// once per run in a new directory so nothing half-filled by an earlier
+// run is ever listed. All of them are removed at exit.
+class ScratchDirs
+{
+public:
+    ScratchDirs() = default;
+
+    ~ScratchDirs()
+    {
+        for( const auto& dir : dirs_ )
+        {
+            Remove( dir.second );
+        }
+    }
+
+    ScratchDirs( const ScratchDirs& ) = delete;
+    ScratchDirs& operator=( const ScratchDirs& ) = delete;
+
+    // the directory with 'entries' files, empty if it can't be made
+    std::string Get( size_t entries )
+    {
+        auto it = dirs_.find( entries );
+        if( it != dirs_.end() )
+        {
+            return it->second;
+        }
+
+        char path[] = "/tmp/fcpp-microbench.XXXXXX";
+        if( ! ::mkdtemp( path ) )
+        {
+            return std::string();
+        }
+
+        for( size_t i = 0; i < entries; ++i )
+        {
+            auto name = std::string { path } + "/file-" + std::to_string( i );
+            int fd = ::open( name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644 );
+            if( -1 == fd )
+            {
+                Remove( path );
+                return std::string();
+            }
+            ::close( fd );
+        }
+        return dirs_[ entries ] = path;
+    }
+
+private:
+    static void Remove( const std::string& path )
+    {
+        ::nftw( path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS );
+    }
+
+    std::map< size_t, std::string > dirs_;
+};
+
+ScratchDirs scratch;
+
+template< typename Render >
+void RenderDirectory( benchmark::State& state, Render render )
+{
+    const auto path = scratch.Get( state.range( 0 ) );
+    if( path.empty() )
+    {
+        state.SkipWithError( "could not create the scratch directory" );
+        return;
+    }
+    std::string buf;
+    buf.reserve( fcpp::Directory::flushSize + 4096 );
+
+    for( auto _ : state )
+    {
+        fcpp::Directory dir { AT_FDCWD, path.c_str() };
+        render( dir, buf );
+    }
+    state.SetItemsProcessed( state.iterations() * state.range( 0 ) );
+}
+
+void RenderList( benchmark::State& state )
+{
+    RenderDirectory( state, []( fcpp::Directory& dir, std::string& buf ) {
+        dir.Render( buf, fcpp::Directory::flushSize, []( std::string& out ) {
+            benchmark::DoNotOptimize( out.data() );
+            out.clear();
+        } );
+    } );
+}
+BENCHMARK( RenderList )->Arg( 1000 )->Arg( 100000 )
+                       ->Unit( benchmark::kMillisecond );
+
+void RenderNames( benchmark::State& state )
+{
+    RenderDirectory( state, []( fcpp::Directory& dir, std::string& buf ) {
+        dir.RenderNames( buf, fcpp::Directory::flushSize,
+                         []( std::string& out ) {
+            benchmark::DoNotOptimize( out.data() );
+            out.clear();
+        } );
+    } );
+}
+BENCHMARK( RenderNames )->Arg( 1000 )->Arg( 100000 )
+                        ->Unit( benchmark::kMillisecond );
+
+// the reply path: queue a reply and take it out again
+void ReplyQueue( benchmark::State& state )
+{
+    fcpp::ReplyQueue queue;
+    std::vector< std::string > out;
+    out.reserve( 16 );
+    for( auto _ : state )
+    {
+        queue.Push( "226 file downloaded successfully\r\n", false );
+        queue.TakeAll( out );
+        out.clear();
+    }
+}
+BENCHMARK( ReplyQueue );
+
+void MetricsCommand( benchmark::State& state )
+{
+    static fcpp::Metrics metrics { { "RETR", "STOR" } };
+    auto start = fcpp::Metrics::Clock::now();
+    for( auto _ : state )
+    {
+        metrics.Command( 0, start );
+    }
+}
+BENCHMARK( MetricsCommand )->ThreadRange( 1, 8 );
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,128 @@
+#include "Admission.hpp"
+#include <utility>
+
+namespace fcpp
+{
+
+Admission::Ticket::Ticket() :
+    owner_  {},
+    memory_ {}
+{
+}
+
+Admission::Ticket::~Ticket()
+{
+    Reset();
+}
+
+Admission::Ticket::Ticket( Ticket&& other ) :
+    owner_   { other.owner_ },
+    address_ { other.address_ },
+    memory_  { other.memory_ }
+{
+    other.owner_ = nullptr;
+}
+
+Admission::Ticket& Admission::Ticket::operator=( Ticket&& other )
+{
+    if( this != &other )
+    {
+        Reset();
+        std::swap( owner_, other.owner_ );
+        address_ = other.address_;
+        memory_  = other.memory_;
+    }
+    return *this;
+}
+
+void Admission::Ticket::Reset()
+{
+    if( owner_ )
+    {
+        owner_->EndSession( address_, memory_ );
+        owner_ = nullptr;
+    }
+}
+
+Admission::Admission( size_t maxSessions, size_t maxPerAddress,
+                      size_t memoryBudget ) :
+    maxSessions_   { maxSessions },
+    maxPerAddress_ { maxPerAddress },
+    memoryBudget_  { memoryBudget },
+    sessions_      {},
+    memory_        {}
+{
+}
+
+std::string Admission::AdmitSession( const address& addr, size_t memory,
+                                     Ticket& ticket )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+
+    if( maxSessions_ && sessions_ >= maxSessions_ )
+    {
+        return "421 too many users, try again later";
+    }
+
+    auto it = perAddress_.find( addr );
+    if( maxPerAddress_ && it != perAddress_.end() &&
+        it->second >= maxPerAddress_ )
+    {
+        return "421 too many connections from your address";
+    }
+
+    if( memoryBudget_ && memory_ + memory > memoryBudget_ )
+    {
+        return "421 server is out of resources, try again later";
+    }
+
+    ++sessions_;
+    memory_ += memory;
+    if( it == perAddress_.end() )
+    {
+        perAddress_.emplace( addr, 1 );
+    }
+    else
+    {
+        ++it->second;
+    }
+
+    ticket.Reset();
+    ticket.owner_   = this;
+    ticket.address_ = addr;
+    ticket.memory_  = memory;
+    return {};
+}
+
+void Admission::EndSession( const address& addr, size_t memory )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+
+    --sessions_;
+    memory_ -= memory;
+    auto it = perAddress_.find( addr );
+    if( it != perAddress_.end() && 0 == --it->second )
+    {
+        perAddress_.erase( it );
+    }
+}
+
+bool Admission::Reserve( size_t bytes )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+
+    if( memoryBudget_ && memory_ + bytes > memoryBudget_ )
+    {
+        return false;
+    }
+    memory_ += bytes;
+    return true;
+}
+
+void Admission::Release( size_t bytes )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    memory_ -= bytes;
+}
+
+} // namespace ttf
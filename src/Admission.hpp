@@ -0,0 +1,79 @@
+#pragma once
+#include <boost/asio/ip/address.hpp>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace fcpp
+{
+
+// Admission control: caps the number of sessions, overall and per client
+// address, and keeps the memory held by sessions and running transfers
+// within a budget, so a burst of clients is turned away with 421 or queued
+// instead of exhausting descriptors and memory. A limit of 0 means none.
+class Admission
+{
+public:
+    typedef boost::asio::ip::address address;
+
+    // a session's claim on its slot and memory, released on destruction
+    class Ticket
+    {
+    public:
+        Ticket();
+        ~Ticket();
+
+        Ticket( Ticket&& other );
+        Ticket& operator=( Ticket&& other );
+
+        Ticket( const Ticket& ) = delete;
+        Ticket& operator=( const Ticket& ) = delete;
+
+    private:
+        friend class Admission;
+
+        void Reset();
+
+        Admission*  owner_;
+        address     address_;
+        size_t      memory_;
+    };
+
+    Admission( size_t maxSessions, size_t maxPerAddress,
+               size_t memoryBudget );
+
+    Admission( const Admission& ) = delete;
+    Admission& operator=( const Admission& ) = delete;
+
+    // Claims a session slot and 'memory' bytes for a client connecting
+    // from 'addr'. Returns an empty string and fills 'ticket' if the
+    // session is admitted, otherwise the reply to refuse it with.
+    std::string AdmitSession( const address& addr, size_t memory,
+                              Ticket& ticket );
+
+    // whether 'bytes' fit the memory budget at all, once nothing else
+    // holds any
+    bool Fits( size_t bytes ) const
+    {
+        return 0 == memoryBudget_ || bytes <= memoryBudget_;
+    }
+
+    // takes 'bytes' from the memory budget if that much is left
+    bool Reserve( size_t bytes );
+    void Release( size_t bytes );
+
+private:
+    void EndSession( const address& addr, size_t memory );
+
+    const size_t                maxSessions_;
+    const size_t                maxPerAddress_;
+    const size_t                memoryBudget_;
+
+    std::mutex                  mutex_;
+    size_t                      sessions_;
+    size_t                      memory_;
+    std::map< address, size_t > perAddress_;
+};
+
+} // namespace ttf
@@ -0,0 +1,224 @@
+#include "Checksum.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+namespace fcpp
+{
+namespace checksum
+{
+
+namespace
+{
+struct Info
+{
+    Algorithm   algorithm;
+    const char* name;
+    const char* attribute; // extended attribute caching the digest
+};
+
+const Info infos[] {
+    { Algorithm::Crc32,  "CRC32",   "user.fcpp.crc32"  },
+    { Algorithm::Md5,    "MD5",     "user.fcpp.md5"    },
+    { Algorithm::Sha256, "SHA-256", "user.fcpp.sha256" }
+};
+
+const Info& InfoOf( Algorithm algorithm )
+{
+    return *std::find_if( std::begin( infos ), std::end( infos ),
+                          [ algorithm ]( const Info& info ) {
+                              return info.algorithm == algorithm;
+                          } );
+}
+
+std::string Hex( const unsigned char* data, size_t len )
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve( 2 * len );
+    for( size_t i = 0; i < len; ++i )
+    {
+        hex += digits[ data[ i ] >> 4 ];
+        hex += digits[ data[ i ] & 0xf ];
+    }
+    return hex;
+}
+
+// feeds the file range to 'update' in memory sized chunks
+template< typename Update >
+void Read( int fd, uint64_t offset, uint64_t count, Update update )
+{
+    ::posix_fadvise( fd, offset, count, POSIX_FADV_SEQUENTIAL );
+
+    std::vector< char > buf ( memory );
+    while( count > 0 )
+    {
+        auto n = ::pread( fd, buf.data(),
+                          (size_t)std::min< uint64_t >( buf.size(), count ),
+                          offset );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            throw std::runtime_error {
+                ( boost::format( "pread failed (%s)" )
+                                 % ::strerror( errno ) ).str()
+            };
+        }
+        if( 0 == n )
+        {
+            break; // truncated meanwhile
+        }
+
+        update( buf.data(), (size_t)n );
+        offset += n;
+        count  -= n;
+    }
+}
+
+// zlib's CRC-32 (the one XCRC means), slice-by-N or carry-less multiply
+// depending on how zlib was built; SSE4.2's crc32 instruction computes
+// CRC-32C, which is a different checksum
+std::string Crc32( int fd, uint64_t offset, uint64_t count )
+{
+    uLong crc = ::crc32( 0, nullptr, 0 );
+    Read( fd, offset, count, [ &crc ]( const char* data, size_t len ) {
+        crc = ::crc32_z( crc, (const Bytef*)data, len );
+    } );
+    return ( boost::format( "%08x" ) % crc ).str();
+}
+
+// OpenSSL picks SHA-NI, AVX2 or SSSE3 code at runtime
+std::string Evp( const EVP_MD* md, int fd, uint64_t offset, uint64_t count )
+{
+    std::unique_ptr< EVP_MD_CTX, void(*)( EVP_MD_CTX* ) > ctx {
+        ::EVP_MD_CTX_new(), ::EVP_MD_CTX_free
+    };
+    if( ! ctx || 1 != ::EVP_DigestInit_ex( ctx.get(), md, nullptr ) )
+    {
+        throw std::runtime_error { "EVP_DigestInit_ex failed" };
+    }
+
+    Read( fd, offset, count, [ &ctx ]( const char* data, size_t len ) {
+        ::EVP_DigestUpdate( ctx.get(), data, len );
+    } );
+
+    unsigned char digest[ EVP_MAX_MD_SIZE ];
+    unsigned len = 0;
+    if( 1 != ::EVP_DigestFinal_ex( ctx.get(), digest, &len ) )
+    {
+        throw std::runtime_error { "EVP_DigestFinal_ex failed" };
+    }
+    return Hex( digest, len );
+}
+
+std::string Compute( int fd, Algorithm algorithm, uint64_t offset,
+                     uint64_t count )
+{
+    switch( algorithm )
+    {
+    case Algorithm::Crc32:
+        return Crc32( fd, offset, count );
+    case Algorithm::Md5:
+        return Evp( ::EVP_md5(), fd, offset, count );
+    case Algorithm::Sha256:
+        break;
+    }
+    return Evp( ::EVP_sha256(), fd, offset, count );
+}
+
+// what a cached digest is valid for, the attribute holds "<key> <digest>"
+std::string CacheKey( const struct stat& st )
+{
+    return ( boost::format( "%d %d.%09d" )
+                            % st.st_size % st.st_mtim.tv_sec
+                            % st.st_mtim.tv_nsec ).str();
+}
+
+bool SameVersion( const struct stat& a, const struct stat& b )
+{
+    return a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+           a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+} // namespace
+
+const char* Name( Algorithm algorithm )
+{
+    return InfoOf( algorithm ).name;
+}
+
+bool Parse( boost::string_view name, Algorithm& algorithm )
+{
+    for( const auto& info : infos )
+    {
+        if( boost::iequals( name, info.name ) )
+        {
+            algorithm = info.algorithm;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Digest( int fd, Algorithm algorithm, uint64_t offset,
+                    uint64_t count )
+{
+    struct stat before;
+    if( -1 == ::fstat( fd, &before ) )
+    {
+        throw std::runtime_error { "could not stat file" };
+    }
+
+    const auto& info = InfoOf( algorithm );
+    bool whole = 0 == offset && count >= (uint64_t)before.st_size;
+    if( ! whole )
+    {
+        return Compute( fd, algorithm, offset, count );
+    }
+
+    auto key = CacheKey( before );
+    char cached[ 256 ];
+    auto len = ::fgetxattr( fd, info.attribute, cached, sizeof( cached ) );
+    if( len > (ssize_t)key.size() &&
+        0 == key.compare( 0, key.size(), cached, key.size() ) &&
+        cached[ key.size() ] == ' ' )
+    {
+        return std::string( cached + key.size() + 1,
+                            len - key.size() - 1 );
+    }
+
+    auto digest = Compute( fd, algorithm, 0, before.st_size );
+
+    // only cache what still describes the file, filesystems without user
+    // attributes or read-only files just go without
+    struct stat after;
+    if( 0 == ::fstat( fd, &after ) && SameVersion( before, after ) )
+    {
+        auto value = key + ' ' + digest;
+        if( -1 == ::fsetxattr( fd, info.attribute, value.data(),
+                               value.size(), 0 ) )
+        {
+            LOG_DEBUG( "not caching %s digest (%s)", info.name,
+                       ::strerror( errno ) );
+        }
+    }
+    return digest;
+}
+
+} // namespace checksum
+} // namespace ttf
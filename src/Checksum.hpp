@@ -0,0 +1,40 @@
+#pragma once
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fcpp
+{
+namespace checksum
+{
+
+enum class Algorithm
+{
+    Crc32,
+    Md5,
+    Sha256
+};
+
+const Algorithm algorithms[] {
+    Algorithm::Crc32, Algorithm::Md5, Algorithm::Sha256
+};
+
+// read buffer of a Digest() call, for admission control
+constexpr size_t memory = 1 << 20;
+
+// the name HASH and FEAT use, "CRC32", "MD5" or "SHA-256"
+const char* Name( Algorithm algorithm );
+
+// looks up a HASH name, case-insensitive; false if it is unknown
+bool Parse( boost::string_view name, Algorithm& algorithm );
+
+// Lower-case hex digest of 'count' bytes of the regular file 'fd' starting
+// at 'offset', shorter if the file is. Digests of a whole file are kept in
+// an extended attribute along with the file's size and mtime, and served
+// from there while both match. Throws std::runtime_error on read errors.
+std::string Digest( int fd, Algorithm algorithm, uint64_t offset,
+                    uint64_t count );
+
+} // namespace checksum
+} // namespace ttf
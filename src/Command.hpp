@@ -1,43 +1,130 @@
 #pragma once
-#include "Utils.hpp"
-#include <stdexcept>
-#include <string>
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <cstring>
 
 namespace fcpp
 {
 
+// One control channel command. Both fields point into the connection's
+// receive buffer and are only valid while the command is being processed.
+// The line is terminated in place, so 'arg' is always followed by a NUL and
+// arg.data() can be handed to the C APIs directly.
 struct Command
 {
-    Command( const Command& ) = default;
-    Command( Command&& ) = default;
-
     Command() = default;
-    Command( std::string src )
+
+    // 'line' holds one command without its line terminator, line[ len ]
+    // must be writable since it receives the NUL
+    Command( char* line, size_t len )
     {
-        if( src.find( "\r\n" ) ==  std::string::npos )
+        line[ len ] = '\0';
+
+        auto space = static_cast< char* >( std::memchr( line, ' ', len ) );
+        if( space )
         {
-            throw std::invalid_argument
-            {
-                "invalid command format '" + src + "'"
-            };
+            command = { line, size_t( space - line ) };
+            arg     = { space + 1, size_t( line + len - space - 1 ) };
         }
+        else
+        {
+            command = { line, len };
+            arg     = { line + len, 0 };
+        }
+    }
 
-        StringRepl( src, "\r\n", "" );
+    boost::string_view command;
+    boost::string_view arg { "" };
+};
+
+// Receive buffer of a control connection. Reads are appended to the free
+// space, Next() then splits off one complete line after the other, so
+// commands a client pipelined into a single read are all seen, in order.
+// A partial line stays in the buffer until the rest of it arrives.
+class CommandReader
+{
+public:
+    // longest command line accepted, not counting the line terminator
+    static constexpr size_t maxLineLength = 4096;
 
-        auto pos = src.find( " " );
-        if( pos != std::string::npos )
+    enum class Status
+    {
+        Ready,      // 'cmd' holds the next command
+        NeedMore,   // no complete line left, read more
+        TooLong     // a line exceeded maxLineLength and was dropped
+    };
+
+    // free space for the next read
+    boost::asio::mutable_buffers_1 Prepare()
+    {
+        // move the unfinished line to the front
+        if( head_ > 0 )
         {
-            command = src.substr( 0, pos );
-            arg     = src.substr( pos + 1 );
+            std::memmove( buf_.data(), buf_.data() + head_, tail_ - head_ );
+            tail_ -= head_;
+            head_  = 0;
         }
-        else
+
+        return boost::asio::buffer( buf_.data() + tail_,
+                                    buf_.size() - tail_ );
+    }
+
+    void Commit( size_t bytes )
+    {
+        tail_ += bytes;
+    }
+
+    Status Next( Command& cmd )
+    {
+        for( ;; )
         {
-            command = src;
+            char* begin = buf_.data() + head_;
+            auto  lf    = static_cast< char* >(
+                                std::memchr( begin, '\n', tail_ - head_ ) );
+            if( ! lf )
+            {
+                // room for the CR but no LF yet is still fine
+                if( tail_ - head_ <= maxLineLength + 1 )
+                {
+                    return Status::NeedMore;
+                }
+
+                head_ = tail_ = 0;
+                if( discarding_ )
+                {
+                    return Status::NeedMore;
+                }
+                // drop everything up to the end of this line
+                discarding_ = true;
+                return Status::TooLong;
+            }
+
+            head_ = lf + 1 - buf_.data();
+            if( discarding_ )
+            {
+                discarding_ = false;
+                continue;
+            }
+
+            // CRLF per RFC 959, a bare LF is accepted as well
+            char* end = lf > begin && lf[ -1 ] == '\r' ? lf - 1 : lf;
+            if( size_t( end - begin ) > maxLineLength )
+            {
+                return Status::TooLong;
+            }
+
+            cmd = Command { begin, size_t( end - begin ) };
+            return Status::Ready;
         }
     }
 
-    std::string command;
-    std::string arg;
+private:
+    std::array< char, 2 * maxLineLength > buf_;
+    size_t head_ = 0;           // start of the first unparsed line
+    size_t tail_ = 0;           // end of the received data
+    bool   discarding_ = false; // skipping the rest of an overlong line
 };
 
 } // namespace ttf
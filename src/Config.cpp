@@ -0,0 +1,287 @@
+#include "Config.hpp"
+#include "Deflate.hpp"
+#include "FileCache.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace fcpp
+{
+
+namespace
+{
+unsigned long ToNumber( const std::string& name, const std::string& value )
+{
+    try
+    {
+        size_t pos = 0;
+        auto n = std::stoul( value, &pos );
+        if( pos == value.size() )
+        {
+            return n;
+        }
+    }
+    catch( std::exception& )
+    {
+    }
+
+    throw std::invalid_argument {
+        ( boost::format( "invalid value '%s' for option '%s'" )
+                         % value % name ).str()
+    };
+}
+
+// stoul() takes "-1" and wraps it, so ports are range checked here
+uint16_t ToPort( const std::string& name, const std::string& value )
+{
+    auto port = ToNumber( name, value );
+    if( 0 == port || port > 65535 )
+    {
+        throw std::invalid_argument {
+            ( boost::format( "invalid port '%s' for option '%s'" )
+                             % value % name ).str()
+        };
+    }
+    return (uint16_t)port;
+}
+} // namespace
+
+Config::Config() :
+    address    { "127.0.0.1" },
+    port       { 8021 },
+    root       { "." },
+    threads    { std::thread::hardware_concurrency() },
+    reusePort  {},
+    pinThreads {},
+    transferThreads  {},
+    transferQueue    { 1024 },
+    sessionTransfers { 4 },
+    deflateThreads   {},
+    pasvFirst        { 32768 },
+    pasvLast         { 49151 },
+    pasvPrebound     { 16 },
+    pasvTimeout      { 30 },
+    idleTimeout      { 300 },
+    stallTimeout     { 60 },
+    listCacheBytes   { 64 * 1024 * 1024 },
+    fileCacheBytes   { 64 * 1024 * 1024 },
+    logLevel         { log::Info },
+    metricsInterval  { 10 },
+    globalRate       {},
+    userRate         {},
+    sessionRate      {},
+    siteAdmin        {},
+    maxSessions      { 1000 },
+    maxPerAddress    {},
+    memoryBudget     { 512 * 1024 * 1024 }
+{
+    if( 0 == threads )
+    {
+        threads = 1;
+    }
+    // transfers mostly block on the network, allow a few per core
+    transferThreads = 4 * threads;
+    deflateThreads  = threads;
+}
+
+Config Config::Parse( int argc, const char* argv[] )
+{
+    Config config;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        std::string arg { argv[ i ] };
+        if( arg.compare( 0, 2, "--" ) != 0 )
+        {
+            throw std::invalid_argument { "unknown argument '" + arg + "'" };
+        }
+
+        auto eq = arg.find( '=' );
+        auto name  = arg.substr( 2, eq == std::string::npos ? eq : eq - 2 );
+        auto value = eq == std::string::npos ? "" : arg.substr( eq + 1 );
+
+        if( name == "address" )
+        {
+            config.address = value;
+        }
+        else if( name == "root" )
+        {
+            config.root = value;
+        }
+        else if( name == "port" )
+        {
+            config.port = ToPort( name, value );
+        }
+        else if( name == "threads" )
+        {
+            config.threads = ToNumber( name, value );
+            if( 0 == config.threads )
+            {
+                throw std::invalid_argument { "--threads must be at least 1" };
+            }
+        }
+        else if( name == "transfer-threads" )
+        {
+            config.transferThreads = ToNumber( name, value );
+        }
+        else if( name == "transfer-queue" )
+        {
+            config.transferQueue = ToNumber( name, value );
+        }
+        else if( name == "session-transfers" )
+        {
+            config.sessionTransfers = ToNumber( name, value );
+        }
+        else if( name == "deflate-threads" )
+        {
+            config.deflateThreads = ToNumber( name, value );
+        }
+        else if( name == "pasv-ports" )
+        {
+            auto dash = value.find( '-' );
+            auto first = ToPort( name, value.substr( 0, dash ) );
+            auto last  = dash == std::string::npos ? first :
+                         ToPort( name, value.substr( dash + 1 ) );
+            if( first > last )
+            {
+                throw std::invalid_argument {
+                    "--pasv-ports must be a range FIRST-LAST of ports"
+                };
+            }
+            config.pasvFirst = first;
+            config.pasvLast  = last;
+        }
+        else if( name == "pasv-prebind" )
+        {
+            config.pasvPrebound = ToNumber( name, value );
+        }
+        else if( name == "pasv-timeout" )
+        {
+            config.pasvTimeout = ToNumber( name, value );
+        }
+        else if( name == "idle-timeout" )
+        {
+            config.idleTimeout = ToNumber( name, value );
+        }
+        else if( name == "stall-timeout" )
+        {
+            config.stallTimeout = ToNumber( name, value );
+        }
+        else if( name == "list-cache" )
+        {
+            config.listCacheBytes = ToNumber( name, value );
+        }
+        else if( name == "file-cache" )
+        {
+            config.fileCacheBytes = ToNumber( name, value );
+        }
+        else if( name == "log-level" )
+        {
+            const char* const levels[] { "debug", "info", "warn", "error" };
+            auto level = std::find( std::begin( levels ), std::end( levels ),
+                                    value );
+            if( level == std::end( levels ) )
+            {
+                throw std::invalid_argument {
+                    "--log-level must be one of debug, info, warn, error"
+                };
+            }
+            config.logLevel = int( level - std::begin( levels ) );
+        }
+        else if( name == "metrics-file" )
+        {
+            config.metricsFile = value;
+        }
+        else if( name == "metrics-interval" )
+        {
+            config.metricsInterval = ToNumber( name, value );
+            if( 0 == config.metricsInterval )
+            {
+                throw std::invalid_argument {
+                    "--metrics-interval must be at least 1"
+                };
+            }
+        }
+        else if( name == "global-rate" )
+        {
+            config.globalRate = ToNumber( name, value );
+        }
+        else if( name == "user-rate" )
+        {
+            config.userRate = ToNumber( name, value );
+        }
+        else if( name == "session-rate" )
+        {
+            config.sessionRate = ToNumber( name, value );
+        }
+        else if( name == "site-admin" )
+        {
+            config.siteAdmin = true;
+        }
+        else if( name == "max-sessions" )
+        {
+            config.maxSessions = ToNumber( name, value );
+        }
+        else if( name == "max-per-address" )
+        {
+            config.maxPerAddress = ToNumber( name, value );
+        }
+        else if( name == "memory-budget" )
+        {
+            config.memoryBudget = ToNumber( name, value );
+        }
+        else if( name == "reuseport" )
+        {
+            config.reusePort = true;
+        }
+        else if( name == "pin" )
+        {
+            config.pinThreads = true;
+        }
+        else
+        {
+            throw std::invalid_argument { "unknown option '" + arg + "'" };
+        }
+    }
+
+    char root[ PATH_MAX + 1 ];
+    if( ! ::realpath( config.root.c_str(), root ) )
+    {
+        throw std::invalid_argument {
+            ( boost::format( "invalid root directory '%s' (%s)" )
+                             % config.root % ::strerror( errno ) ).str()
+        };
+    }
+    config.root = root;
+
+    if( 0 == config.transferThreads || 0 == config.sessionTransfers )
+    {
+        throw std::invalid_argument {
+            "--transfer-threads and --session-transfers must be at least 1"
+        };
+    }
+
+    // the most a single transfer reserves, a MODE Z download of a file
+    // about to be cached, has to fit or such a transfer never starts
+    size_t transferMemory = deflate::sendMemory +
+                            FileCache::MaxEntrySize( config.fileCacheBytes );
+    if( config.memoryBudget && config.memoryBudget < transferMemory )
+    {
+        throw std::invalid_argument {
+            ( boost::format( "--memory-budget must be 0 or at least %d "
+                             "bytes with this --file-cache" )
+                             % transferMemory ).str()
+        };
+    }
+
+    return config;
+}
+
+} // namespace ttf
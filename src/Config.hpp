@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fcpp
+{
+
+// server settings, defaults can be overridden from the command line with
+// --name=value (or just --name for switches)
+struct Config
+{
+    Config();
+
+    static Config Parse( int argc, const char* argv[] );
+
+    std::string address;    // control connection listen address
+    uint16_t    port;       // control connection listen port
+    std::string root;       // initial working directory of every session
+    size_t      threads;    // reactor threads, one io_service each
+    bool        reusePort;  // one SO_REUSEPORT acceptor per reactor thread
+    bool        pinThreads; // pin reactor thread N to CPU N
+
+    size_t      transferThreads;  // threads running data transfers
+    size_t      transferQueue;    // transfers allowed to wait for a thread
+    size_t      sessionTransfers; // concurrent transfers per session
+    size_t      deflateThreads;   // threads compressing MODE Z downloads
+    uint16_t    pasvFirst;        // passive data ports, inclusive range
+    uint16_t    pasvLast;
+    size_t      pasvPrebound;     // passive listeners bound in advance
+    size_t      pasvTimeout;      // seconds a PASV listener stays open
+    size_t      idleTimeout;      // seconds without commands or transfers
+                                  // before a session is closed, 0 = never
+    size_t      stallTimeout;     // seconds a transfer may make no progress
+    size_t      listCacheBytes;   // memory for cached LIST output, 0 = off
+    size_t      fileCacheBytes;   // memory for popular small files, 0 = off
+    int         logLevel;         // log::Level, messages below are dropped
+    std::string metricsFile;      // Prometheus text dump, empty = none
+    size_t      metricsInterval;  // seconds between dumps
+    uint64_t    globalRate;       // bytes/s for all transfers, 0 = no limit
+    uint64_t    userRate;         // bytes/s per user name
+    uint64_t    sessionRate;      // bytes/s per session
+    bool        siteAdmin;        // SITE RATE may change global/user limits
+    size_t      maxSessions;      // sessions at a time, 0 = no limit
+    size_t      maxPerAddress;    // sessions per client address
+    size_t      memoryBudget;     // bytes for sessions and transfer buffers
+};
+
+} // namespace ttf
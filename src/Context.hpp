@@ -0,0 +1,61 @@
+#pragma once
+#include "Admission.hpp"
+#include "Config.hpp"
+#include "Deflate.hpp"
+#include "FileCache.hpp"
+#include "Ftp.hpp"
+#include "ListingCache.hpp"
+#include "Metrics.hpp"
+#include "PortPool.hpp"
+#include "Shaper.hpp"
+#include "TransferExecutor.hpp"
+#include <boost/asio/ip/address.hpp>
+#include <string>
+#include <sys/socket.h>
+
+namespace fcpp
+{
+
+// server-wide state shared by all connections
+struct Context
+{
+    explicit Context( const Config& cfg ) :
+        config      { cfg },
+        metrics     { ftp::CommandNames() },
+        shaper      { cfg.globalRate, cfg.userRate },
+        admission   { cfg.maxSessions, cfg.maxPerAddress, cfg.memoryBudget },
+        compression { cfg.deflateThreads },
+        listings    { cfg.listCacheBytes },
+        files       { cfg.fileCacheBytes },
+        ports       {
+            PassiveFamily( cfg.address ), cfg.pasvFirst, cfg.pasvLast,
+            cfg.pasvPrebound
+        },
+        transfers   { cfg.transferThreads, cfg.transferQueue, admission }
+    {
+    }
+
+    Context( const Context& ) = delete;
+    Context& operator=( const Context& ) = delete;
+
+    // PASV/EPSV listeners are of the control connections' address family;
+    // an invalid address is left to the TcpServer to report
+    static int PassiveFamily( const std::string& address )
+    {
+        boost::system::error_code error;
+        auto ip = boost::asio::ip::address::from_string( address, error );
+        return ! error && ip.is_v6() ? AF_INET6 : AF_INET;
+    }
+
+    const Config        config;
+    Metrics             metrics;     // outlives the transfer threads
+    Shaper              shaper;      // likewise
+    Admission           admission;   // likewise
+    deflate::Pool       compression; // likewise, transfers wait on it
+    ListingCache        listings;    // likewise
+    FileCache           files;       // likewise
+    PortPool            ports;       // likewise, jobs release PASV ports
+    TransferExecutor    transfers;   // last, its destructor joins threads
+};
+
+} // namespace ttf
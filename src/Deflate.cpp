@@ -0,0 +1,536 @@
+#include "Deflate.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <strings.h>
+#include <unistd.h>
+
+namespace fcpp
+{
+namespace deflate
+{
+
+namespace
+{
+// file types deflate gains nothing on
+const char* const compressedExtensions[] {
+    "7z", "avi", "bz2", "flac", "gif", "gz", "jpeg", "jpg", "mkv", "mov",
+    "mp3", "mp4", "ogg", "png", "rar", "tbz", "tgz", "txz", "webm", "webp",
+    "xz", "zip", "zst"
+};
+
+struct Magic
+{
+    size_t      offset;
+    size_t      size;
+    const char* bytes;
+};
+
+const Magic compressedMagic[] {
+    { 0, 2, "\x1f\x8b" },                 // gzip
+    { 0, 4, "PK\x03\x04" },               // zip, jar, office documents
+    { 0, 3, "BZh" },                      // bzip2
+    { 0, 6, "\xfd" "7zXZ\x00" },          // xz
+    { 0, 4, "\x28\xb5\x2f\xfd" },         // zstd
+    { 0, 6, "7z\xbc\xaf\x27\x1c" },       // 7-zip
+    { 0, 4, "Rar!" },
+    { 0, 8, "\x89PNG\r\n\x1a\n" },
+    { 0, 3, "\xff\xd8\xff" },             // jpeg
+    { 0, 4, "GIF8" },
+    { 0, 4, "OggS" },
+    { 0, 4, "fLaC" },
+    { 4, 4, "ftyp" },                     // mp4, mov
+    { 0, 4, "\x1a\x45\xdf\xa3" }          // matroska, webm
+};
+
+struct Deflater
+{
+    void operator()( z_stream* stream ) const
+    {
+        ::deflateEnd( stream );
+    }
+};
+typedef std::unique_ptr< z_stream, Deflater > DeflaterPtr;
+
+// reads exactly 'len' bytes of the file at 'offset'
+void ReadAll( int fd, char* data, size_t len, uint64_t offset )
+{
+    while( len > 0 )
+    {
+        auto n = ::pread( fd, data, len, offset );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            throw std::runtime_error {
+                ( boost::format( "pread failed (%s)" )
+                                 % ::strerror( errno ) ).str()
+            };
+        }
+        if( 0 == n )
+        {
+            throw std::runtime_error { "file was truncated while sending" };
+        }
+        data   += n;
+        len    -= n;
+        offset += n;
+    }
+}
+
+void InitDeflate( z_stream& stream, int level, int windowBits )
+{
+    if( Z_OK != ::deflateInit2( &stream, level, Z_DEFLATED, windowBits, 8,
+                                Z_DEFAULT_STRATEGY ) )
+    {
+        throw std::runtime_error { "deflateInit2 failed" };
+    }
+}
+
+// Compresses the 'len' bytes at 'in' into a raw deflate block, primed with
+// the 'dictLen' bytes before them. All but the last block end with a sync
+// flush so the blocks concatenate into one stream.
+Block Compress( const char* in, size_t dictLen, size_t len, int level,
+                bool last )
+{
+    in -= dictLen;
+
+    z_stream stream {};
+    InitDeflate( stream, level, -MAX_WBITS );
+    DeflaterPtr guard { &stream };
+
+    if( dictLen )
+    {
+        ::deflateSetDictionary( &stream, (const Bytef*)in, dictLen );
+    }
+
+    Block block;
+    block.length = len;
+    block.check  = ::adler32( ::adler32( 0, nullptr, 0 ),
+                              (const Bytef*)in + dictLen, len );
+    block.data.resize( ::deflateBound( &stream, len ) + 16 );
+
+    stream.next_in  = (Bytef*)in + dictLen;
+    stream.avail_in = len;
+
+    size_t produced = 0;
+    for( ;; )
+    {
+        stream.next_out  = (Bytef*)block.data.data() + produced;
+        stream.avail_out = block.data.size() - produced;
+        auto rc = ::deflate( &stream, last ? Z_FINISH : Z_SYNC_FLUSH );
+        if( rc == Z_STREAM_ERROR )
+        {
+            throw std::runtime_error { "deflate failed" };
+        }
+        produced = block.data.size() - stream.avail_out;
+
+        if( last ? rc == Z_STREAM_END : stream.avail_out != 0 )
+        {
+            break;
+        }
+        block.data.resize( 2 * block.data.size() );
+    }
+
+    block.data.resize( produced );
+    return block;
+}
+
+// the same for 'len' bytes of the file at 'offset'
+Block Compress( int fd, uint64_t offset, size_t dictLen, size_t len,
+                int level, bool last )
+{
+    std::vector< char > in ( dictLen + len );
+    ReadAll( fd, in.data(), in.size(), offset - dictLen );
+    return Compress( in.data() + dictLen, dictLen, len, level, last );
+}
+
+// RFC 1950 stream header for deflate with a 32 KiB window
+void ZlibHeader( char header[ 2 ], int level )
+{
+    unsigned flevel = level == Z_DEFAULT_COMPRESSION ? 2 :
+                      level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    unsigned value = ( 0x78 << 8 ) | ( flevel << 6 );
+    value += 31 - value % 31;
+    header[ 0 ] = char( value >> 8 );
+    header[ 1 ] = char( value & 0xff );
+}
+} // namespace
+
+Pool::Pool( size_t threads ) :
+    stopped_ {}
+{
+    for( size_t i = 0; i < threads; ++i )
+    {
+        threads_.emplace_back( &Pool::Run, this );
+    }
+}
+
+Pool::~Pool()
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        stopped_ = true;
+        queue_.clear();
+    }
+
+    cond_.notify_all();
+    for( auto& thread : threads_ )
+    {
+        thread.join();
+    }
+}
+
+void Pool::Post( Job job )
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        queue_.push_back( std::move( job ) );
+    }
+    cond_.notify_one();
+}
+
+void Pool::Run()
+{
+    std::unique_lock< std::mutex > lock { mutex_ };
+
+    for( ;; )
+    {
+        cond_.wait( lock, [ this ]() {
+            return stopped_ || ! queue_.empty();
+        } );
+        if( stopped_ )
+        {
+            return;
+        }
+
+        Job job = std::move( queue_.front() );
+        queue_.pop_front();
+
+        lock.unlock();
+        job(); // packaged tasks, failures go to the waiting transfer
+        job = nullptr;
+        lock.lock();
+    }
+}
+
+bool Incompressible( const char* name, const char* head, size_t len )
+{
+    auto dot = ::strrchr( name, '.' );
+    if( dot && std::any_of( std::begin( compressedExtensions ),
+                            std::end( compressedExtensions ),
+                            [ dot ]( const char* ext ) {
+                                return 0 == ::strcasecmp( dot + 1, ext );
+                            } ) )
+    {
+        return true;
+    }
+
+    return std::any_of( std::begin( compressedMagic ),
+                        std::end( compressedMagic ),
+                        [ head, len ]( const Magic& magic ) {
+                            return len >= magic.offset + magic.size &&
+                                   0 == ::memcmp( head + magic.offset,
+                                                  magic.bytes, magic.size );
+                        } );
+}
+
+bool Incompressible( const char* name, int fd )
+{
+    char head[ 16 ];
+    auto len = ::pread( fd, head, sizeof( head ), 0 );
+    return Incompressible( name, head, len > 0 ? len : 0 );
+}
+
+Writer::Writer( tcp::socket& socket, int level ) :
+    socket_   ( socket ),
+    stream_   {},
+    out_      ( blockSize ),
+    sent_     {}
+{
+    InitDeflate( stream_, level, MAX_WBITS );
+}
+
+Writer::~Writer()
+{
+    ::deflateEnd( &stream_ );
+}
+
+void Writer::Write( const char* data, size_t len )
+{
+    stream_.next_in  = (Bytef*)data;
+    stream_.avail_in = len;
+    Deflate( Z_NO_FLUSH );
+}
+
+uint64_t Writer::Finish()
+{
+    Deflate( Z_FINISH );
+    return sent_;
+}
+
+int Writer::Deflate( int flush )
+{
+    int rc = Z_OK;
+    do
+    {
+        stream_.next_out  = (Bytef*)out_.data();
+        stream_.avail_out = out_.size();
+        rc = ::deflate( &stream_, flush );
+        if( rc == Z_STREAM_ERROR )
+        {
+            throw std::runtime_error { "deflate failed" };
+        }
+        sent_ += transfer::SendBuffer( socket_, out_.data(),
+                                       out_.size() - stream_.avail_out );
+    }
+    while( stream_.avail_out == 0 );
+
+    return rc;
+}
+
+Sender::Sender( int fd, uint64_t offset, uint64_t count, int level,
+                Pool& pool ) :
+    fd_         { fd },
+    data_       { nullptr },
+    offset_     { offset },
+    count_      { count },
+    level_      { level },
+    pool_       { 0 == level || ! pool.enabled() || count <= 2 * blockSize
+                  ? nullptr : &pool },
+    blockLevel_ { level },
+    queued_     {},
+    check_      { ::adler32( 0, nullptr, 0 ) },
+    next_       { Part::Header },
+    outSent_    {},
+    sent_       {}
+{
+}
+
+Sender::Sender( const char* data, size_t len, int level ) :
+    fd_         { -1 },
+    data_       { data },
+    offset_     {},
+    count_      { len },
+    level_      { level },
+    pool_       { nullptr },
+    blockLevel_ { level },
+    queued_     {},
+    check_      { ::adler32( 0, nullptr, 0 ) },
+    next_       { Part::Header },
+    outSent_    {},
+    sent_       {}
+{
+}
+
+Sender::~Sender()
+{
+    // blocks still being compressed read the file
+    for( auto& block : pending_ )
+    {
+        block.wait();
+    }
+}
+
+bool Sender::Send( tcp::socket& socket, const transfer::Throttle& throttle )
+{
+    for( ;; )
+    {
+        if( outSent_ < out_.size() )
+        {
+            auto n = transfer::SendBuffer( socket, out_.data() + outSent_,
+                                           out_.size() - outSent_, throttle );
+            outSent_ += n;
+            sent_    += n;
+            if( outSent_ < out_.size() )
+            {
+                return false;
+            }
+        }
+
+        if( ! Produce() )
+        {
+            return true;
+        }
+    }
+}
+
+bool Sender::Produce()
+{
+    out_.clear();
+    outSent_ = 0;
+
+    switch( next_ )
+    {
+    case Part::Header:
+        out_.resize( 2 );
+        ZlibHeader( out_.data(), level_ );
+        next_ = Part::Blocks;
+        return true;
+
+    case Part::Blocks:
+    {
+        Block block = NextBlock();
+
+        // data that didn't shrink by 1/32 was compressed already, don't
+        // spend CPU on the rest
+        if( blockLevel_ != 0 &&
+            block.data.size() > block.length - block.length / 32 )
+        {
+            LOG_DEBUG( "incompressible data, sending the rest stored" );
+            blockLevel_ = 0;
+        }
+
+        check_ = ::adler32_combine( check_, block.check, block.length );
+        out_ = std::move( block.data );
+        if( queued_ == count_ && pending_.empty() )
+        {
+            next_ = Part::Trailer;
+        }
+        return true;
+    }
+
+    case Part::Trailer:
+        out_ = {
+            char( check_ >> 24 ), char( check_ >> 16 ), char( check_ >> 8 ),
+            char( check_ )
+        };
+        next_ = Part::Done;
+        return true;
+
+    case Part::Done:
+        break;
+    }
+    return false;
+}
+
+Block Sender::NextBlock()
+{
+    if( ! pool_ )
+    {
+        auto len = (size_t)std::min< uint64_t >( blockSize,
+                                                 count_ - queued_ );
+        auto dictLen = (size_t)std::min< uint64_t >( dictionarySize,
+                                                      queued_ );
+        bool last = queued_ + len == count_;
+        auto at = queued_;
+        queued_ += len;
+        return data_ ? Compress( data_ + at, dictLen, len, blockLevel_,
+                                 last )
+                     : Compress( fd_, offset_ + at, dictLen, len,
+                                 blockLevel_, last );
+    }
+
+    // keep a window of blocks compressing ahead of the one sent
+    while( queued_ < count_ && pending_.size() < window )
+    {
+        auto len = (size_t)std::min< uint64_t >( blockSize,
+                                                 count_ - queued_ );
+        auto dictLen = (size_t)std::min< uint64_t >( dictionarySize,
+                                                      queued_ );
+        bool last = queued_ + len == count_;
+        auto task = std::make_shared< std::packaged_task< Block() > >(
+            [ fd = fd_, at = offset_ + queued_, dictLen, len,
+              level = blockLevel_, last ]() {
+                return Compress( fd, at, dictLen, len, level, last );
+            } );
+        pending_.push_back( task->get_future() );
+        pool_->Post( [ task ]() { ( *task )(); } );
+        queued_ += len;
+    }
+
+    Block block = pending_.front().get();
+    pending_.pop_front();
+    return block;
+}
+
+Receiver::Receiver( int fd, uint64_t offset ) :
+    fd_      { fd },
+    offset_  { offset },
+    stream_  {},
+    in_      ( blockSize ),
+    out_     ( 2 * blockSize ),
+    written_ {},
+    allowed_ {}
+{
+    if( Z_OK != ::inflateInit( &stream_ ) )
+    {
+        throw std::runtime_error { "inflateInit failed" };
+    }
+}
+
+Receiver::~Receiver()
+{
+    ::inflateEnd( &stream_ );
+}
+
+bool Receiver::Receive( tcp::socket& socket,
+                        const transfer::Throttle& throttle )
+{
+    int rc = Z_OK;
+    while( rc != Z_STREAM_END )
+    {
+        if( 0 == allowed_ )
+        {
+            allowed_ = throttle ? throttle( in_.size() ) : in_.size();
+            if( 0 == allowed_ )
+            {
+                return false;
+            }
+        }
+
+        boost::system::error_code error;
+        auto n = socket.read_some( boost::asio::buffer( in_.data(), allowed_ ),
+                                   error );
+        if( error == boost::asio::error::eof )
+        {
+            throw transfer::DataConnectionError {
+                "data connection closed before the end of the compressed "
+                "stream"
+            };
+        }
+        if( error )
+        {
+            throw transfer::DataConnectionError {
+                ( boost::format( "error receiving file: %s" )
+                                 % error.message()
+                ).str()
+            };
+        }
+        allowed_ -= n;
+
+        stream_.next_in  = (Bytef*)in_.data();
+        stream_.avail_in = n;
+        do
+        {
+            stream_.next_out  = (Bytef*)out_.data();
+            stream_.avail_out = out_.size();
+            rc = ::inflate( &stream_, Z_NO_FLUSH );
+            if( rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR )
+            {
+                throw std::runtime_error {
+                    ( boost::format( "invalid compressed data (%s)" )
+                                     % ( stream_.msg ? stream_.msg : "" )
+                    ).str()
+                };
+            }
+
+            auto len = out_.size() - stream_.avail_out;
+            transfer::WriteAll( fd_, out_.data(), len, offset_ + written_ );
+            written_ += len;
+        }
+        while( stream_.avail_out == 0 && rc != Z_STREAM_END );
+    }
+
+    return true;
+}
+
+} // namespace deflate
+} // namespace ttf
@@ -0,0 +1,250 @@
+#pragma once
+#include "Transfer.hpp"
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+using boost::asio::ip::tcp;
+
+namespace fcpp
+{
+namespace deflate
+{
+
+// MODE Z (draft-preston-ftpext-deflate): the data connection carries one
+// zlib stream (RFC 1950) per transfer.
+
+constexpr int defaultLevel = Z_DEFAULT_COMPRESSION;
+
+// input a compression job works on, big files are sent as a sequence of
+// blocks compressed in parallel
+constexpr size_t blockSize = 1 << 17;
+// blocks of one transfer being compressed or waiting to be sent
+constexpr size_t window = 8;
+// what a block is primed with, deflate's window
+constexpr size_t dictionarySize = 32 * 1024;
+
+// deflateBound() of 'len' bytes at the windowBits and memLevel used here,
+// plus the slack a block's output buffer gets
+constexpr size_t DeflateBound( size_t len )
+{
+    return len + ( len >> 12 ) + ( len >> 14 ) + ( len >> 25 ) + 7 + 16;
+}
+
+// zlib's estimate of a deflate stream's state at windowBits 15 and memLevel
+// 8, (1 << (windowBits + 2)) + (1 << (memLevel + 9)), plus the struct
+constexpr size_t deflateState = ( 1 << 17 ) + ( 1 << 17 ) + 8 * 1024;
+
+// a block being compressed: its input with the dictionary before it, the
+// output buffer and the zlib state
+constexpr size_t blockMemory = dictionarySize + blockSize +
+                               DeflateBound( blockSize ) + deflateState;
+
+// Most memory (buffers and zlib state) a Writer, a Sender with every block
+// of its window compressing plus the one being sent and a Receiver hold,
+// for admission control.
+constexpr size_t writerMemory  = 4 * blockSize;
+constexpr size_t sendMemory    = window * blockMemory +
+                                 DeflateBound( blockSize );
+constexpr size_t receiveMemory = 4 * blockSize;
+
+// Threads compressing the blocks of big downloads. Transfers wait on their
+// blocks, so the pool is separate from the transfer threads.
+class Pool
+{
+public:
+    typedef std::function< void() > Job;
+
+    explicit Pool( size_t threads );
+    ~Pool();
+
+    Pool( const Pool& ) = delete;
+    Pool& operator=( const Pool& ) = delete;
+
+    // false if there are no threads and callers compress on their own
+    bool enabled() const
+    {
+        return ! threads_.empty();
+    }
+
+    void Post( Job job );
+
+private:
+    void Run();
+
+    std::mutex                  mutex_;
+    std::condition_variable     cond_;
+    std::deque< Job >           queue_;
+    bool                        stopped_;
+    std::vector< std::thread >  threads_;
+};
+
+// Whether the file 'fd' named 'name' holds data deflate can't shrink
+// (archives, images, video..), judged by its extension and first bytes.
+// Such files are sent at level 0, as stored blocks.
+bool Incompressible( const char* name, int fd );
+
+// the same for a file whose contents start with the 'len' bytes 'head'
+bool Incompressible( const char* name, const char* head, size_t len );
+
+// Compresses whatever is written to it into a zlib stream on the socket.
+// Models asio's SyncWriteStream so boost::asio::write() works with it;
+// errors are thrown like transfer::SendFile's, whichever overload is used.
+class Writer
+{
+public:
+    Writer( tcp::socket& socket, int level );
+    ~Writer();
+
+    Writer( const Writer& ) = delete;
+    Writer& operator=( const Writer& ) = delete;
+
+    void Write( const char* data, size_t len );
+
+    // ends the stream, returns the compressed bytes sent
+    uint64_t Finish();
+
+    template< typename ConstBufferSequence >
+    size_t write_some( const ConstBufferSequence& buffers )
+    {
+        size_t written = 0;
+        for( auto it = boost::asio::buffer_sequence_begin( buffers );
+             it != boost::asio::buffer_sequence_end( buffers ); ++it )
+        {
+            boost::asio::const_buffer buffer { *it };
+            Write( static_cast< const char* >( buffer.data() ),
+                   buffer.size() );
+            written += buffer.size();
+        }
+        return written;
+    }
+
+    template< typename ConstBufferSequence >
+    size_t write_some( const ConstBufferSequence& buffers,
+                       boost::system::error_code& error )
+    {
+        error = boost::system::error_code();
+        return write_some( buffers );
+    }
+
+private:
+    // deflate()s the pending input with 'flush' and sends the output
+    int Deflate( int flush );
+
+    tcp::socket&                socket_;
+    z_stream                    stream_;
+    std::vector< char >         out_;
+    uint64_t                    sent_;
+};
+
+// a block compressed on the pool
+struct Block
+{
+    std::vector< char > data;   // raw deflate, ends on a byte boundary
+    uLong               check;  // adler32 of the input
+    size_t              length; // input bytes
+};
+
+// Sends 'count' bytes of the file 'fd' from 'offset', or a buffer in
+// memory, as a zlib stream compressed at 'level'. Input is compressed a
+// block at a time, each block primed with the 32 KiB before it so the ratio
+// stays close to a single stream; files of several blocks are compressed on
+// 'pool', a window of blocks ahead of the one being sent. Once blocks stop
+// shrinking the rest is sent stored.
+class Sender
+{
+public:
+    Sender( int fd, uint64_t offset, uint64_t count, int level, Pool& pool );
+    // 'data' has to outlive the Sender
+    Sender( const char* data, size_t len, int level );
+    ~Sender();
+
+    Sender( const Sender& ) = delete;
+    Sender& operator=( const Sender& ) = delete;
+
+    // Sends as much of the stream as 'throttle' allows. Returns true once
+    // all of it is sent, false if the throttle stopped it early; the next
+    // call carries on from there. Throws like transfer::SendFile.
+    bool Send( tcp::socket& socket,
+               const transfer::Throttle& throttle = transfer::Throttle() );
+
+    // compressed bytes sent so far
+    uint64_t sent() const
+    {
+        return sent_;
+    }
+
+private:
+    enum class Part
+    {
+        Header,
+        Blocks,
+        Trailer,
+        Done
+    };
+
+    // puts the next part of the stream into out_, false once there is none
+    bool Produce();
+    Block NextBlock();
+
+    const int                           fd_;
+    const char* const                   data_;
+    const uint64_t                      offset_;
+    const uint64_t                      count_;
+    const int                           level_;
+    Pool* const                         pool_; // nullptr: compress inline
+    int                                 blockLevel_;
+    uint64_t                            queued_; // input handed to Compress
+    std::deque< std::future< Block > >  pending_;
+    uLong                               check_;
+    Part                                next_;
+    std::vector< char >                 out_;
+    size_t                              outSent_;
+    uint64_t                            sent_;
+};
+
+// Inflates the zlib stream the client sends into the file 'fd' at 'offset'.
+class Receiver
+{
+public:
+    Receiver( int fd, uint64_t offset );
+    ~Receiver();
+
+    Receiver( const Receiver& ) = delete;
+    Receiver& operator=( const Receiver& ) = delete;
+
+    // Receives as much of the stream as 'throttle' allows. Returns true
+    // once the stream ended, false if the throttle stopped it early; the
+    // next call carries on from there. Throws DataConnectionError if the
+    // connection ends before the stream does and std::runtime_error if
+    // the data is not a valid stream.
+    bool Receive( tcp::socket& socket,
+                  const transfer::Throttle& throttle = transfer::Throttle() );
+
+    // bytes written to the file so far
+    uint64_t written() const
+    {
+        return written_;
+    }
+
+private:
+    const int               fd_;
+    const uint64_t          offset_;
+    z_stream                stream_;
+    std::vector< char >     in_;
+    std::vector< char >     out_;
+    uint64_t                written_;
+    size_t                  allowed_; // granted by the throttle, not read
+};
+
+} // namespace deflate
+} // namespace ttf
@@ -1,50 +1,306 @@
 #pragma once
-#include "Ftp.hpp"
-#include "Server.hpp"
+#include "ListingCache.hpp"
+#include "Utils.hpp"
+#include <atomic>
 #include <dirent.h>
 #include <boost/asio.hpp>
 #include <boost/asio/ip/tcp.hpp>
-#include <boost/filesystem.hpp>
 #include <boost/format.hpp>
-#include <boost/range/iterator_range.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <ctime>
+#include <unistd.h>
 
-namespace
+using boost::asio::ip::tcp;
+
+namespace fcpp
 {
-std::string permissions2string( int perm )
+
+// the part of a file's status a listing line needs
+struct EntryStat
 {
-    std::string permissions;
+    dev_t       dev;
+    ino_t       ino;
+    mode_t      mode;
+    nlink_t     nlink;
+    uid_t       uid;
+    gid_t       gid;
+    off_t       size;
+    time_t      mtime;
+};
 
-    for( int i = 6; i >= 0; i -= 3 )
+// Fills 'st' for 'name' inside the directory 'dirfd' without following
+// symlinks. Uses statx(2) asking only for the fields above where available.
+inline bool StatEntry( int dirfd, const char* name, EntryStat& st )
+{
+#ifdef STATX_BASIC_STATS
+    static std::atomic< bool > haveStatx { true };
+    if( haveStatx )
     {
-        auto current = ( ( perm & ALLPERMS ) >> i ) & 0x7;
-
-        auto read   = (current >> 2) & 0x1;
-        auto write  = (current >> 1) & 0x1;
-        auto exec   = (current >> 0) & 0x1;
+        struct statx stx;
+        if( 0 == ::statx( dirfd, name,
+                          AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                          STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID |
+                          STATX_GID | STATX_SIZE | STATX_MTIME | STATX_INO,
+                          &stx ) )
+        {
+            st.dev   = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+            st.ino   = stx.stx_ino;
+            st.mode  = stx.stx_mode;
+            st.nlink = stx.stx_nlink;
+            st.uid   = stx.stx_uid;
+            st.gid   = stx.stx_gid;
+            st.size  = stx.stx_size;
+            st.mtime = stx.stx_mtime.tv_sec;
+            return true;
+        }
+        if( errno != ENOSYS )
+        {
+            return false;
+        }
+        haveStatx = false;
+    }
+#endif
 
-        permissions += (
-            boost::format( "%c%c%c" )
-                           % ( read  ? 'r' : '-' )
-                           % ( write ? 'w' : '-' )
-                           % ( exec  ? 'x' : '-' )
-        ).str();
+    struct stat statbuf;
+    if( -1 == ::fstatat( dirfd, name, &statbuf, AT_SYMLINK_NOFOLLOW ) )
+    {
+        return false;
     }
 
-    return permissions;
+    st.dev   = statbuf.st_dev;
+    st.ino   = statbuf.st_ino;
+    st.mode  = statbuf.st_mode;
+    st.nlink = statbuf.st_nlink;
+    st.uid   = statbuf.st_uid;
+    st.gid   = statbuf.st_gid;
+    st.size  = statbuf.st_size;
+    st.mtime = statbuf.st_mtime;
+    return true;
 }
+
+// appends 'value' right aligned in a field of 'width' characters
+inline void AppendNumber( std::string& out, unsigned long long value,
+                          size_t width )
+{
+    char buf[ 24 ];
+    char* end = buf + sizeof( buf );
+    char* p = end;
+    do
+    {
+        *--p = (char)( '0' + value % 10 );
+        value /= 10;
+    } while( value );
+
+    size_t len = end - p;
+    if( len < width )
+    {
+        out.append( width - len, ' ' );
+    }
+    out.append( p, len );
 }
 
-namespace fcpp
+// Appends one ls style line, e.g.
+// "-rw-r--r--     1 1000 1000     4096 Mar 01 12:00 name\r\n".
+// Doesn't allocate once 'out' has grown to its working size.
+inline void AppendListEntry( std::string& out, const EntryStat& st,
+                             const char* name, size_t nameLen )
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    char mode[ 11 ];
+    mode[ 0 ] = S_ISDIR( st.mode ) ? 'd' : S_ISLNK( st.mode ) ? 'l' : '-';
+    for( int i = 0; i < 9; ++i )
+    {
+        mode[ i + 1 ] = ( st.mode & ( 0400 >> i ) ) ? "rwx"[ i % 3 ] : '-';
+    }
+    mode[ 10 ] = ' ';
+    out.append( mode, sizeof( mode ) );
+
+    AppendNumber( out, st.nlink, 5 );
+    out += ' ';
+    AppendNumber( out, st.uid, 4 );
+    out += ' ';
+    AppendNumber( out, st.gid, 4 );
+    out += ' ';
+    AppendNumber( out, st.size, 8 );
+    out += ' ';
+
+    struct tm tm;
+    ::gmtime_r( &st.mtime, &tm );
+    char date[ 13 ] = {
+        months[ tm.tm_mon * 3 ], months[ tm.tm_mon * 3 + 1 ],
+        months[ tm.tm_mon * 3 + 2 ], ' ',
+        (char)( '0' + tm.tm_mday / 10 ), (char)( '0' + tm.tm_mday % 10 ), ' ',
+        (char)( '0' + tm.tm_hour / 10 ), (char)( '0' + tm.tm_hour % 10 ), ':',
+        (char)( '0' + tm.tm_min / 10 ), (char)( '0' + tm.tm_min % 10 ), ' '
+    };
+    out.append( date, sizeof( date ) );
+
+    out.append( name, nameLen );
+    out.append( "\r\n", 2 );
+}
+
+// RFC 3659 facts MLSD/MLST can report, see OPTS MLST
+namespace mlst
+{
+enum Fact : unsigned
+{
+    Type     = 1 << 0,
+    Size     = 1 << 1,
+    Modify   = 1 << 2,
+    Perm     = 1 << 3,
+    Unique   = 1 << 4,
+    UnixMode = 1 << 5,
+
+    All      = ( 1 << 6 ) - 1,
+    Default  = Type | Size | Modify | Perm,
+};
+
+// in the order they are reported
+static const struct
 {
+    Fact        fact;
+    const char* name;
+} names[] {
+    { Type,     "type" },
+    { Size,     "size" },
+    { Modify,   "modify" },
+    { Perm,     "perm" },
+    { Unique,   "unique" },
+    { UnixMode, "unix.mode" },
+};
+} // namespace mlst
+
+// Appends an MLSx entry ("type=file;size=42; name") without the line end.
+// 'st' may be null when 'facts' is just Type and 'dtype' is known.
+// 'dtype' is the readdir d_type, DT_UNKNOWN for a single MLST target.
+inline void AppendFacts( std::string& out, unsigned facts,
+                         const EntryStat* st, unsigned char dtype,
+                         const char* name, size_t nameLen )
+{
+    bool dir = st ? S_ISDIR( st->mode ) : dtype == DT_DIR;
+
+    if( facts & mlst::Type )
+    {
+        out += "type=";
+        if( dir && nameLen == 1 && name[ 0 ] == '.' )
+        {
+            out += "cdir";
+        }
+        else if( dir && nameLen == 2 && name[ 0 ] == '.' && name[ 1 ] == '.' )
+        {
+            out += "pdir";
+        }
+        else if( dir )
+        {
+            out += "dir";
+        }
+        else if( st ? S_ISREG( st->mode ) || S_ISLNK( st->mode )
+                    : dtype == DT_REG || dtype == DT_LNK )
+        {
+            out += "file";
+        }
+        else
+        {
+            out += "OS.unix=special";
+        }
+        out += ';';
+    }
+    if( st && ( facts & mlst::Size ) )
+    {
+        out += "size=";
+        AppendNumber( out, st->size, 0 );
+        out += ';';
+    }
+    if( st && ( facts & mlst::Modify ) )
+    {
+        struct tm tm;
+        ::gmtime_r( &st->mtime, &tm );
+        out += "modify=";
+        AppendNumber( out, tm.tm_year + 1900, 4 );
+        const int parts[] {
+            tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec
+        };
+        for( auto part : parts )
+        {
+            out += (char)( '0' + part / 10 );
+            out += (char)( '0' + part % 10 );
+        }
+        out += ';';
+    }
+    if( st && ( facts & mlst::Perm ) )
+    {
+        // what the server process may do, from the matching permission bits
+        auto bits = st->mode;
+        if( st->uid == ::geteuid() )
+        {
+            bits >>= 6;
+        }
+        else if( st->gid == ::getegid() )
+        {
+            bits >>= 3;
+        }
+        bool r = bits & 4, w = bits & 2, x = bits & 1;
+
+        out += "perm=";
+        if( dir )
+        {
+            out += w ? "cdmp" : "";
+            out += x ? "e" : "";
+            out += r ? "l" : "";
+        }
+        else
+        {
+            out += w ? "adfw" : "";
+            out += r ? "r" : "";
+        }
+        out += ';';
+    }
+    if( st && ( facts & mlst::Unique ) )
+    {
+        char buf[ 40 ];
+        auto len = ::snprintf( buf, sizeof( buf ), "unique=%llxU%llx;",
+                               (unsigned long long)st->dev,
+                               (unsigned long long)st->ino );
+        out.append( buf, len );
+    }
+    if( st && ( facts & mlst::UnixMode ) )
+    {
+        char buf[ 24 ];
+        auto len = ::snprintf( buf, sizeof( buf ), "unix.mode=0%o;",
+                               (unsigned)( st->mode & 07777 ) );
+        out.append( buf, len );
+    }
+
+    out += ' ';
+    out.append( name, nameLen );
+}
 
 struct Directory
 {
-    Directory( const std::string& dir )
+    // chunk size a listing is sent in
+    static constexpr size_t flushSize = 256 * 1024;
+
+    // opens 'dir' relative to the directory descriptor 'base'
+    Directory( int base, const char* dir )
     {
-        ptr = ::opendir( dir.c_str() );
+        int fd = ::openat( base, *dir ? dir : ".",
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+        ptr = fd == -1 ? nullptr : ::fdopendir( fd );
+        if( ! ptr && fd != -1 )
+        {
+            ::close( fd );
+        }
         if( ! ptr )
         {
             throw std::runtime_error {
@@ -61,61 +317,185 @@ struct Directory
         ::closedir( ptr );
     }
 
-    void List( Session& session )
+    Directory( const Directory& ) = delete;
+    Directory& operator=( const Directory& ) = delete;
+
+    // Appends the listing to 'out', handing it to 'flush' (which must
+    // consume it) whenever it grows past 'chunk' bytes. Entries are stat'ed
+    // relative to the directory's own descriptor.
+    template< typename Flush >
+    void Render( std::string& out, size_t chunk, Flush flush )
     {
-        tcp::socket socket = session.AcceptPassiveConn();
+        const int fd = ::dirfd( ptr );
+        EntryStat st;
 
-        session.connection.SendReply< ReplyType::NoResponse >(
-                                        "150 sending directory contents.." );
+        ForEach( out, chunk, flush, [ fd, &st ]( std::string& out,
+                                                 const dirent* entry ) {
+            if( ! StatEntry( fd, entry->d_name, st ) )
+            {
+                PRINT_ERR_STR(
+                    ( boost::format( "error reading file stats for '%s'" )
+                                     % entry->d_name
+                    ).str()
+                );
+                return;
+            }
 
-        char timebuf[80];
-        struct stat statbuf;
+            AppendListEntry( out, st, entry->d_name,
+                             ::strlen( entry->d_name ) );
+        } );
+    }
 
-        // TODO : replace with boost
-        struct dirent *entry;
-        while( ( entry = ::readdir( ptr ) ) )
-        {
-            if( -1 == ::stat( entry->d_name, &statbuf ) )
+    // NLST: one name per line, straight from readdir without any stat
+    template< typename Flush >
+    void RenderNames( std::string& out, size_t chunk, Flush flush )
+    {
+        ForEach( out, chunk, flush, []( std::string& out,
+                                        const dirent* entry ) {
+            auto len = ::strlen( entry->d_name );
+            if( ( len == 1 && entry->d_name[ 0 ] == '.' ) ||
+                ( len == 2 && entry->d_name[ 0 ] == '.' &&
+                              entry->d_name[ 1 ] == '.' ) )
+            {
+                return;
+            }
+
+            out.append( entry->d_name, len );
+            out.append( "\r\n", 2 );
+        } );
+    }
+
+    // MLSD: one line of 'facts' per entry. When only the type is asked for
+    // the readdir d_type is enough and entries aren't stat'ed.
+    template< typename Flush >
+    void RenderFacts( std::string& out, size_t chunk, unsigned facts,
+                      Flush flush )
+    {
+        const int fd = ::dirfd( ptr );
+        EntryStat st;
+
+        ForEach( out, chunk, flush, [ fd, facts, &st ]( std::string& out,
+                                                        const dirent* entry ) {
+            bool needStat = ( facts & ~mlst::Type ) ||
+                            ( ( facts & mlst::Type ) &&
+                              entry->d_type == DT_UNKNOWN );
+            if( needStat && ! StatEntry( fd, entry->d_name, st ) )
             {
                 PRINT_ERR_STR(
                     ( boost::format( "error reading file stats for '%s'" )
                                      % entry->d_name
                     ).str()
                 );
+                return;
+            }
+
+            AppendFacts( out, facts, needStat ? &st : nullptr,
+                         entry->d_type, entry->d_name,
+                         ::strlen( entry->d_name ) );
+            out.append( "\r\n", 2 );
+        } );
+    }
+
+    // Sends the listing over the data connection, straight from 'cache'
+    // when it holds a current copy. Otherwise the directory is rendered and
+    // sent in flushSize chunks while a copy is collected for the cache.
+    // 'stream' is the data socket, or a deflate::Writer on it in MODE Z.
+    // Returns the number of bytes sent, as do SendNames and SendFacts.
+    template< typename Stream >
+    uint64_t List( Stream& stream, ListingCache& cache )
+    {
+        ListingCache::Ticket ticket;
+        if( auto listing = cache.Find( ::dirfd( ptr ), ticket ) )
+        {
+            return boost::asio::write( stream,
+                                       boost::asio::buffer( *listing ) );
+        }
+
+        uint64_t sent = 0;
+
+        std::string copy;
+        bool keep = ticket.generation != 0;
+
+        std::string buf;
+        buf.reserve( flushSize + 4096 );
+
+        Render( buf, flushSize, [ & ]( std::string& data ) {
+            sent += boost::asio::write( stream, boost::asio::buffer( data ) );
+            if( keep && copy.size() + data.size() <= cache.MaxEntrySize() )
+            {
+                copy += data;
             }
             else
             {
-                auto rawtime = statbuf.st_mtime;
-                auto time = gmtime( &rawtime );
-                strftime( timebuf, sizeof( timebuf ), "%b %d %H:%M", time );
-
-                auto perms = permissions2string( (statbuf.st_mode & ALLPERMS) );
-
-                std::string str = (
-                        boost::format( "%c%s %5ld %4d %4d %8ld %s %s\r\n")
-                                        % ( (entry->d_type == DT_DIR) ?
-                                                'd' : '-' )
-                                        % perms
-                                        % statbuf.st_nlink
-                                        % statbuf.st_uid
-                                        % statbuf.st_gid
-                                        % statbuf.st_size
-                                        % timebuf
-                                        % entry->d_name
-                                   ).str();
-                boost::system::error_code ignored_error;
-                boost::asio::write( socket,
-                                    boost::asio::buffer( str, str.length() ),
-                                    ignored_error );
+                keep = false;
+                copy.clear();
             }
-        } // while
+            data.clear();
+        } );
 
-        session.connection.SendReply( "226 directory contents sent" );
-        session.mode = ConnectionMode::Normal;
+        if( keep )
+        {
+            cache.Insert( ticket,
+                          std::make_shared< const std::string >(
+                                                    std::move( copy ) ) );
+        }
+        return sent;
+    }
+
+    template< typename Stream >
+    uint64_t SendNames( Stream& stream )
+    {
+        return Send( stream, [ this ]( std::string& buf, auto flush ) {
+            RenderNames( buf, flushSize, flush );
+        } );
+    }
+
+    template< typename Stream >
+    uint64_t SendFacts( Stream& stream, unsigned facts )
+    {
+        return Send( stream, [ this, facts ]( std::string& buf, auto flush ) {
+            RenderFacts( buf, flushSize, facts, flush );
+        } );
     }
 
 private:
+    // renders with 'render' and writes every flushSize chunk to 'stream'
+    template< typename Stream, typename Renderer >
+    uint64_t Send( Stream& stream, Renderer render )
+    {
+        std::string buf;
+        buf.reserve( flushSize + 4096 );
+
+        uint64_t sent = 0;
+        render( buf, [ &stream, &sent ]( std::string& data ) {
+            sent += boost::asio::write( stream, boost::asio::buffer( data ) );
+            data.clear();
+        } );
+        return sent;
+    }
+
+    // runs 'append' for every entry and flushes full chunks
+    template< typename Flush, typename Append >
+    void ForEach( std::string& out, size_t chunk, Flush& flush,
+                  Append append )
+    {
+        struct dirent *entry;
+        while( ( entry = ::readdir( ptr ) ) )
+        {
+            append( out, entry );
+            if( out.size() >= chunk )
+            {
+                flush( out );
+            }
+        }
+
+        if( ! out.empty() )
+        {
+            flush( out );
+        }
+    }
+
     DIR* ptr;
 };
 
-}
+} // namespace ttf
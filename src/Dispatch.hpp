@@ -0,0 +1,115 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+namespace fcpp
+{
+namespace dispatch
+{
+
+constexpr size_t maxVerbLength = 8;
+
+// Packs an FTP verb of up to 8 letters into one integer, upper-cased since
+// verbs are case-insensitive. Returns 0 for anything that isn't a verb.
+constexpr uint64_t VerbKey( const char* verb, size_t len )
+{
+    if( len == 0 || len > maxVerbLength )
+    {
+        return 0;
+    }
+
+    uint64_t key = 0;
+    for( size_t i = 0; i < len; ++i )
+    {
+        char c = verb[ i ];
+        if( c >= 'a' && c <= 'z' )
+        {
+            c = (char)( c - 'a' + 'A' );
+        }
+        if( ! ( ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ) )
+        {
+            return 0;
+        }
+        key = ( key << 8 ) | (uint8_t)c;
+    }
+    return key;
+}
+
+constexpr size_t Length( const char* str )
+{
+    size_t len = 0;
+    while( str[ len ] )
+    {
+        ++len;
+    }
+    return len;
+}
+
+constexpr uint64_t VerbKey( const char* verb )
+{
+    return VerbKey( verb, Length( verb ) );
+}
+
+// Collision free multiplicative hash from verb keys to table indices,
+// found at compile time: key * multiplier picks one of 2^Bits slots, each
+// slot holds the index of the one verb that maps there (or 'empty').
+template< size_t Bits >
+struct PerfectHash
+{
+    static constexpr size_t  size  = size_t( 1 ) << Bits;
+    static constexpr uint8_t empty = 0xff;
+
+    constexpr size_t Slot( uint64_t key ) const
+    {
+        return (size_t)( ( key * multiplier ) >> ( 64 - Bits ) );
+    }
+
+    // index of 'key' in the table it was built from, or 'empty'; the
+    // caller still has to compare the key since unknown verbs land in
+    // occupied slots too
+    constexpr uint8_t Find( uint64_t key ) const
+    {
+        return slots[ Slot( key ) ];
+    }
+
+    uint64_t multiplier;
+    uint8_t  slots[ size ];
+};
+
+// 'entries' must have a 'key' member holding VerbKey of the verb
+template< size_t Bits, typename Entry, size_t N >
+constexpr PerfectHash< Bits > MakePerfectHash( const Entry ( &entries )[ N ] )
+{
+    static_assert( N < PerfectHash< Bits >::empty, "too many verbs" );
+
+    PerfectHash< Bits > hash {};
+    // odd multipliers walked with a golden ratio step
+    for( uint64_t m = 0x9e3779b97f4a7c15ull, tries = 0; tries < 100000;
+         m += 0x9e3779b97f4a7c16ull, ++tries )
+    {
+        hash.multiplier = m;
+        for( size_t i = 0; i < hash.size; ++i )
+        {
+            hash.slots[ i ] = hash.empty;
+        }
+
+        bool collision = false;
+        for( size_t i = 0; i < N && ! collision; ++i )
+        {
+            auto slot = hash.Slot( entries[ i ].key );
+            collision = hash.slots[ slot ] != hash.empty;
+            hash.slots[ slot ] = (uint8_t)i;
+        }
+
+        if( ! collision )
+        {
+            return hash;
+        }
+    }
+
+    throw std::logic_error { "no perfect hash found, increase Bits" };
+}
+
+} // namespace dispatch
+} // namespace ttf
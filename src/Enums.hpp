@@ -12,8 +12,8 @@ enum class ConnectionMode
 
 enum class ReplyType
 {
-    WaitResponse,
-    NoResponse
+    Normal,
+    Close // last reply, the connection closes once it is written
 };
 
 } // namespace ttf
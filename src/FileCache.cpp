@@ -0,0 +1,152 @@
+#include "FileCache.hpp"
+#include <cerrno>
+#include <unistd.h>
+
+namespace fcpp
+{
+
+namespace
+{
+// accesses within an aging period that get a file cached
+constexpr unsigned admitHits = 3;
+// accesses after which all counts are halved
+constexpr size_t agingPeriod = 16 * 1024;
+// files whose accesses are counted, beyond that counts age early
+constexpr size_t maxTracked = 16 * 1024;
+
+bool operator==( const timespec& a, const timespec& b )
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+bool SameVersion( const struct stat& a, const struct stat& b )
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+           a.st_size == b.st_size && a.st_mtim == b.st_mtim &&
+           a.st_ctim == b.st_ctim;
+}
+} // namespace
+
+FileCache::FileCache( size_t maxBytes ) :
+    maxBytes_ { maxBytes },
+    bytes_    {},
+    accesses_ {}
+{
+}
+
+FileCache::Data FileCache::Find( const struct stat& st, bool& admit )
+{
+    admit = false;
+    if( ! enabled() || (uint64_t)st.st_size > MaxEntrySize() )
+    {
+        return nullptr;
+    }
+
+    std::lock_guard< std::mutex > lock { mutex_ };
+
+    Key key { st.st_dev, st.st_ino };
+    auto it = entries_.find( key );
+    if( it != entries_.end() )
+    {
+        auto& entry = it->second;
+        if( entry.size == st.st_size && entry.mtime == st.st_mtim &&
+            entry.ctime == st.st_ctim )
+        {
+            lru_.splice( lru_.begin(), lru_, entry.lru );
+            return entry.data;
+        }
+        Drop( it );
+    }
+
+    auto& hits = hits_[ key ];
+    if( hits < admitHits )
+    {
+        ++hits;
+    }
+    admit = hits >= admitHits;
+
+    if( ++accesses_ >= agingPeriod || hits_.size() > maxTracked )
+    {
+        Age();
+    }
+    return nullptr;
+}
+
+FileCache::Data FileCache::Load( int fd, const struct stat& st )
+{
+    if( (uint64_t)st.st_size > MaxEntrySize() )
+    {
+        return nullptr;
+    }
+
+    std::string contents ( st.st_size, '\0' );
+    for( size_t done = 0; done < contents.size(); )
+    {
+        auto n = ::pread( fd, &contents[ done ], contents.size() - done,
+                          done );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( n <= 0 )
+        {
+            return nullptr;
+        }
+        done += n;
+    }
+
+    // the file might have been replaced or written to meanwhile
+    struct stat now;
+    if( -1 == ::fstat( fd, &now ) || ! SameVersion( st, now ) )
+    {
+        return nullptr;
+    }
+
+    auto data = std::make_shared< const std::string >( std::move( contents ) );
+
+    std::lock_guard< std::mutex > lock { mutex_ };
+
+    Key key { st.st_dev, st.st_ino };
+    auto it = entries_.find( key );
+    if( it != entries_.end() )
+    {
+        Drop( it ); // a concurrent Load, the newest one wins
+    }
+
+    lru_.push_front( key );
+    entries_[ key ] = Entry {
+        st.st_size, st.st_mtim, st.st_ctim, data, lru_.begin()
+    };
+    bytes_ += data->size();
+    hits_.erase( key );
+
+    Evict();
+    return data;
+}
+
+void FileCache::Drop( Entries::iterator it )
+{
+    bytes_ -= it->second.data->size();
+    lru_.erase( it->second.lru );
+    entries_.erase( it );
+}
+
+void FileCache::Evict()
+{
+    while( ! lru_.empty() && bytes_ > maxBytes_ )
+    {
+        Drop( entries_.find( lru_.back() ) );
+    }
+}
+
+void FileCache::Age()
+{
+    accesses_ = 0;
+    for( auto it = hits_.begin(); it != hits_.end(); )
+    {
+        it->second /= 2;
+        it = it->second ? std::next( it ) : hits_.erase( it );
+    }
+}
+
+} // namespace ttf
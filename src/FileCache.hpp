@@ -0,0 +1,105 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace fcpp
+{
+
+// Contents of small, frequently downloaded files, shared by all sessions
+// and keyed by the file's device/inode. An entry is valid while the file's
+// size, mtime and ctime are still those it was read with, which RETR checks
+// with a stat of the path, so a hit costs neither an open nor a read. A
+// file is only read into the cache once it was asked for a few times
+// recently; access counts are halved now and then so that old popularity
+// fades. Total size is capped, the least recently used files are evicted
+// first.
+class FileCache
+{
+public:
+    typedef std::shared_ptr< const std::string > Data;
+
+    explicit FileCache( size_t maxBytes );
+
+    FileCache( const FileCache& ) = delete;
+    FileCache& operator=( const FileCache& ) = delete;
+
+    bool enabled() const
+    {
+        return maxBytes_ != 0;
+    }
+
+    // largest file worth keeping
+    size_t MaxEntrySize() const
+    {
+        return MaxEntrySize( maxBytes_ );
+    }
+
+    // the same for a cache of 'maxBytes'
+    static size_t MaxEntrySize( size_t maxBytes )
+    {
+        return maxBytes / 64;
+    }
+
+    // Counts an access to the regular file 'st' describes and returns its
+    // contents if they are cached and current. Otherwise 'admit' tells
+    // whether the file is popular enough now to be Load()ed.
+    Data Find( const struct stat& st, bool& admit );
+
+    // Reads the open file 'fd', which must be the one 'st' describes, into
+    // the cache. Returns its contents, nullptr if the file changed since
+    // 'st' was taken or can't be read.
+    Data Load( int fd, const struct stat& st );
+
+private:
+    struct Key
+    {
+        dev_t dev;
+        ino_t ino;
+
+        bool operator==( const Key& other ) const
+        {
+            return dev == other.dev && ino == other.ino;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const Key& key ) const
+        {
+            return std::hash< uint64_t >()( key.ino ) ^
+                   ( std::hash< uint64_t >()( key.dev ) << 1 );
+        }
+    };
+
+    struct Entry
+    {
+        off_t                       size;
+        timespec                    mtime;
+        timespec                    ctime;
+        Data                        data;
+        std::list< Key >::iterator  lru;
+    };
+
+    typedef std::unordered_map< Key, Entry, KeyHash > Entries;
+
+    void Drop( Entries::iterator it );
+    void Evict();
+    void Age();
+
+    std::mutex                                  mutex_;
+    const size_t                                maxBytes_;
+    size_t                                      bytes_;
+    Entries                                     entries_;
+    std::list< Key >                            lru_; // most recent first
+    std::unordered_map< Key, unsigned, KeyHash > hits_; // files not cached
+    size_t                                      accesses_; // since Age()
+};
+
+} // namespace ttf
@@ -0,0 +1,72 @@
+#pragma once
+#include <unistd.h>
+
+namespace fcpp
+{
+
+// owns a raw file descriptor and closes it on destruction
+struct FileDescriptor
+{
+    FileDescriptor() :
+        fd_ { -1 }
+    {
+    }
+
+    explicit FileDescriptor( int fd ) :
+        fd_ { fd }
+    {
+    }
+
+    ~FileDescriptor()
+    {
+        reset();
+    }
+
+    FileDescriptor( const FileDescriptor& ) = delete;
+    FileDescriptor& operator=( const FileDescriptor& ) = delete;
+
+    FileDescriptor( FileDescriptor&& other ) :
+        fd_ { other.release() }
+    {
+    }
+
+    FileDescriptor& operator=( FileDescriptor&& other )
+    {
+        if( this != &other )
+        {
+            reset( other.release() );
+        }
+        return *this;
+    }
+
+    int get() const
+    {
+        return fd_;
+    }
+
+    explicit operator bool() const
+    {
+        return fd_ != -1;
+    }
+
+    int release()
+    {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+    void reset( int fd = -1 )
+    {
+        if( fd_ != -1 )
+        {
+            ::close( fd_ );
+        }
+        fd_ = fd;
+    }
+
+private:
+    int fd_;
+};
+
+} // namespace ttf
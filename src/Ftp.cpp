@@ -1,24 +1,35 @@
+#include "Checksum.hpp"
 #include "Command.hpp"
+#include "Context.hpp"
+#include "Deflate.hpp"
 #include "Directory.hpp"
+#include "Dispatch.hpp"
+#include "FileCache.hpp"
+#include "FileDescriptor.hpp"
 #include "Ftp.hpp"
-#include "Port.hpp"
+#include "PortPool.hpp"
 #include "Session.hpp"
 #include "Server.hpp"
-#include "SocketCloser.hpp"
+#include "TimerWheel.hpp"
+#include "Transfer.hpp"
+#include "TransferWatch.hpp"
 #include "Utils.hpp"
-#include "WorkingDirChanger.hpp"
 #include <algorithm>
+#include <boost/algorithm/string.hpp>
 #include <boost/asio/ip/tcp.hpp>
-#include <boost/filesystem.hpp>
-#include <iostream>
-#include <fstream>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
 #include <memory>
-#include <thread>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
 
 
-using boost::asio::detail::thread;
 using boost::asio::ip::tcp;
-using std::ofstream;
 
 namespace fcpp
 {
@@ -32,7 +43,10 @@ const std::string notImplemented    = "502 command is not implemented";
 
 const std::string usernames[] { "ftp", "anonymous", "anon" };
 
-constexpr size_t buffSize = 256; // for file transfers
+// FEAT lines besides MLST and HASH, which depend on the session
+const char* const features[] {
+    "EPSV", "MODE Z", "SIZE", "REST STREAM", "XCRC", "XMD5", "XSHA256"
+};
 
 enum class Auth
 {
@@ -44,15 +58,15 @@ struct FtpCommand
 {
     typedef void (*function_t)(const fcpp::Command&, fcpp::Session&);
 
-    FtpCommand( const char* cmd, function_t fn, Auth auth ) :
+    constexpr FtpCommand( const char* cmd, function_t fn, Auth auth ) :
         name     { cmd },
+        key      { dispatch::VerbKey( cmd ) },
         authType { auth },
         func     { fn }
     {
     }
-    ~FtpCommand() {}
 
-    void invoke( const fcpp::Command& cmd, fcpp::Session& session )
+    void invoke( const fcpp::Command& cmd, fcpp::Session& session ) const
     {
         func( cmd, session );
     }
@@ -61,53 +75,754 @@ struct FtpCommand
     FtpCommand& operator=( const FtpCommand& ) = delete;
 
 public:
-    std::string name;
+    const char* name;
+    uint64_t    key;
     Auth        authType;
 
 private:
     function_t  func;
 };
 
-FtpCommand CommanList[] {
+constexpr FtpCommand CommanList[] {
     FtpCommand { "USER",    &fcpp::ftp::user,    Auth::None       },
     FtpCommand { "PASS",    &fcpp::ftp::pass,    Auth::None       },
     FtpCommand { "ABOR",    &fcpp::ftp::abor,    Auth::MustLogIn  },
+    FtpCommand { "ALLO",    &fcpp::ftp::allo,    Auth::MustLogIn  },
+    FtpCommand { "APPE",    &fcpp::ftp::appe,    Auth::MustLogIn  },
     FtpCommand { "CWD",     &fcpp::ftp::cwd,     Auth::MustLogIn  },
     FtpCommand { "DELE",    &fcpp::ftp::dele,    Auth::MustLogIn  },
+    FtpCommand { "EPSV",    &fcpp::ftp::epsv,    Auth::MustLogIn  },
+    FtpCommand { "FEAT",    &fcpp::ftp::feat,    Auth::None       },
+    FtpCommand { "HASH",    &fcpp::ftp::hash,    Auth::MustLogIn  },
     FtpCommand { "LIST",    &fcpp::ftp::list,    Auth::MustLogIn  },
     FtpCommand { "MKD",     &fcpp::ftp::mkd,     Auth::MustLogIn  },
+    FtpCommand { "MLSD",    &fcpp::ftp::mlsd,    Auth::MustLogIn  },
+    FtpCommand { "MLST",    &fcpp::ftp::mlst,    Auth::MustLogIn  },
+    FtpCommand { "MODE",    &fcpp::ftp::mode,    Auth::MustLogIn  },
+    FtpCommand { "NLST",    &fcpp::ftp::nlst,    Auth::MustLogIn  },
     FtpCommand { "NOOP",    &fcpp::ftp::noop,    Auth::MustLogIn  },
+    FtpCommand { "OPTS",    &fcpp::ftp::opts,    Auth::None       },
     FtpCommand { "PASV",    &fcpp::ftp::pasv,    Auth::MustLogIn  },
     FtpCommand { "PWD",     &fcpp::ftp::pwd,     Auth::MustLogIn  },
     FtpCommand { "QUIT",    &fcpp::ftp::quit,    Auth::MustLogIn  },
+    FtpCommand { "REST",    &fcpp::ftp::rest,    Auth::MustLogIn  },
     FtpCommand { "RETR",    &fcpp::ftp::retr,    Auth::MustLogIn  },
     FtpCommand { "RMD",     &fcpp::ftp::rmd,     Auth::MustLogIn  },
+    FtpCommand { "SITE",    &fcpp::ftp::site,    Auth::MustLogIn  },
     FtpCommand { "SIZE",    &fcpp::ftp::size,    Auth::MustLogIn  },
     FtpCommand { "STOR",    &fcpp::ftp::stor,    Auth::MustLogIn  },
     FtpCommand { "TYPE",    &fcpp::ftp::type,    Auth::MustLogIn  },
+    FtpCommand { "XCRC",    &fcpp::ftp::xcrc,    Auth::MustLogIn  },
+    FtpCommand { "XMD5",    &fcpp::ftp::xmd5,    Auth::MustLogIn  },
+    FtpCommand { "XSHA256", &fcpp::ftp::xsha256, Auth::MustLogIn  },
 };
 
-} // namespace
+// verb -> CommanList index, built at compile time
+constexpr size_t commandCount = std::extent< decltype( CommanList ) >::value;
 
-void ProcessCommand( const Command& cmd, Session& session)
+typedef dispatch::PerfectHash< 8 > CommandHash;
+constexpr CommandHash commandHash =
+                        dispatch::MakePerfectHash< 8 >( CommanList );
+
+const FtpCommand* FindCommand( boost::string_view verb )
+{
+    auto key = dispatch::VerbKey( verb.data(), verb.size() );
+    auto index = commandHash.Find( key );
+    if( index == CommandHash::empty || CommanList[ index ].key != key )
+    {
+        return nullptr;
+    }
+
+    return &CommanList[ index ];
+}
+
+// Parses the unsigned decimal number 'arg' starts with. Returns the number
+// of digits used, 0 if there is no number or it doesn't fit.
+size_t ParseNumber( boost::string_view arg, uint64_t& value )
+{
+    value = 0;
+    size_t i = 0;
+    for( ; i < arg.size() && arg[ i ] >= '0' && arg[ i ] <= '9'; ++i )
+    {
+        uint64_t digit = arg[ i ] - '0';
+        if( value > ( std::numeric_limits< uint64_t >::max() - digit ) / 10 )
+        {
+            return 0;
+        }
+        value = value * 10 + digit;
+    }
+    return i;
+}
+
+typedef std::shared_ptr< FileDescriptor > FilePtr;
+
+// Opens 'path' relative to the session's working directory. Files are
+// opened on the session's io_service so a later CWD can't change what the
+// transfer refers to. On failure the PASV acceptor is dropped and a null
+// pointer is returned.
+FilePtr OpenFile( Session& session, const char* path, int flags )
+{
+    FilePtr file = std::make_shared< FileDescriptor >(
+                        ::openat( session.cwdFd.get(), path,
+                                  flags | O_CLOEXEC, 0666 ) );
+    if( ! *file )
+    {
+        PRINT_ERR_STR(
+            ( boost::format( "failed to open '%s' (%s)" )
+                             % path % ::strerror( errno ) ).str()
+        );
+        session.ClosePassiveConn();
+        return nullptr;
+    }
+
+    return file;
+}
+
+// checks the transfer every stall timeout from the session's io_service
+// until it is done, or dropped from the transfer queue
+void Watch( TimerWheel& wheel, std::chrono::seconds interval,
+            std::weak_ptr< TransferWatch > transfer )
+{
+    wheel.Schedule( interval, [ &wheel, interval, transfer ]() {
+        auto watch = transfer.lock();
+        if( watch && watch->Check() != TransferWatch::State::Done )
+        {
+            Watch( wheel, interval, transfer );
+        }
+    } );
+}
+
+// Waits for the passive data connection, then runs 'worker' with it on
+// the transfer threads once 'memory' bytes of buffers are available. The
+// worker returns false when it deferred itself (see Deferred), it is then
+// run again later; the data connection is closed once it returns true.
+template< typename Worker >
+void StartTransfer( Session& session, Worker worker, size_t memory )
+{
+    auto connection = session.connection.get();
+    session.AcceptPassiveConn( [ worker, connection, memory, &session ](
+                                                    tcp::socket socket )
+    {
+        auto pasvSocket = std::make_shared< tcp::socket >(
+                                                    std::move( socket ) );
+        auto watch = std::make_shared< TransferWatch >(
+                                                pasvSocket->native_handle() );
+        if( auto stall = session.context.config.stallTimeout )
+        {
+            Watch( connection->wheel(), std::chrono::seconds( stall ),
+                   watch );
+        }
+
+        // queued or running, the transfer keeps the session from idling
+        auto busy = connection->Busy();
+        auto& metrics = session.context.metrics;
+        session.PostTransfer( [ worker, connection, pasvSocket, watch, busy,
+                                &metrics, started = false ]() mutable {
+            if( ! started )
+            {
+                started = true;
+                metrics.TransferStarted();
+                watch->Started();
+            }
+            if( ! worker( connection, *pasvSocket, *watch ) )
+            {
+                return;
+            }
+            watch->Finish( [ &pasvSocket ]() {
+                boost::system::error_code ignored;
+                pasvSocket->close( ignored );
+            } );
+            metrics.TransferEnded();
+        }, memory );
+    } );
+}
+
+// the address the client reached the control connection on, IPv4 clients
+// of a dual-stack listener as IPv4
+boost::asio::ip::address LocalAddress( Session& session )
+{
+    auto local = session.connection.socket().local_endpoint().address();
+    if( local.is_v6() && local.to_v6().is_v4_mapped() )
+    {
+        return local.to_v6().to_v4();
+    }
+    return local;
+}
+
+// Takes a passive listener from the port pool for the session's next data
+// connection. Replies 425 and returns false if there is none.
+bool OpenPassive( Session& session, uint16_t& port )
+{
+    auto& ports = session.context.ports;
+    PortPool::Listener listener {};
+    try
+    {
+        listener = ports.Acquire();
+        std::unique_ptr< tcp::acceptor > acceptor {
+            new tcp::acceptor {
+                session.connection.io_service(),
+                AF_INET6 == ports.family() ? tcp::v6() : tcp::v4(),
+                listener.fd.get()
+            }
+        };
+        listener.fd.release(); // owned by the acceptor now
+
+        // the port goes back to the pool with the last reference to the
+        // acceptor, once the data connection was accepted or timed out
+        auto released = listener.port;
+        session.pasvPtr = Session::AcceptorPtr(
+            acceptor.release(),
+            [ &ports, released ]( tcp::acceptor* pasv ) {
+                delete pasv;
+                ports.Release( released );
+            }
+        );
+    }
+    catch( std::exception& ex )
+    {
+        PRINT_EX( ex );
+        if( listener.fd )
+        {
+            listener.fd.reset();
+            ports.Release( listener.port );
+        }
+        session.ClosePassiveConn();
+        session.connection.SendReply( "425 no passive port available" );
+        return false;
+    }
+    port = listener.port;
+
+    // a listener nobody connects to in time is closed to free its port, a
+    // transfer still waiting on it then fails with 425; one no transfer took
+    // yet is dropped from the session, which returns the port right away
+    std::weak_ptr< tcp::acceptor > acceptor = session.pasvPtr;
+    boost::weak_ptr< TcpConnection > connection = session.connection.get();
+    auto owner = &session; // lives as long as the connection
+    session.connection.wheel().Schedule(
+        std::chrono::seconds( session.context.config.pasvTimeout ),
+        [ acceptor, connection, owner ]() {
+            if( auto pasv = acceptor.lock() )
+            {
+                boost::system::error_code ignored;
+                pasv->close( ignored );
+                if( connection.lock() && owner->pasvPtr == pasv )
+                {
+                    owner->ClosePassiveConn();
+                }
+            }
+        } );
+
+    session.mode = ConnectionMode::Passive;
+    return true;
+}
+
+// feeds a transfer's chunks through the bandwidth shaper
+transfer::Throttle Shaped( Shaper::Transfer& shaping )
+{
+    return [ &shaping ]( size_t len ) { return shaping.Acquire( len ); };
+}
+
+// Whether the shaper stopped the transfer early. Its job is then deferred
+// for as long as the shaper asks instead of sleeping on a transfer thread,
+// and the worker carries on where it stopped when it runs again. The wait
+// doesn't count as a stall.
+bool Deferred( const Shaper::Transfer& shaping, TransferExecutor& transfers,
+               TransferWatch& watch )
+{
+    if( shaping.Wait() == Shaper::Clock::duration::zero() )
+    {
+        return false;
+    }
+    watch.Throttled();
+    transfers.Defer( shaping.Wait() );
+    return true;
+}
+
+// Opens the directory named by the command argument and, once the data
+// connection is up, sends it with 'send' on the transfer threads (stat'ing
+// a big directory takes a while). 'send' writes to the data socket, or to
+// a deflate::Writer in MODE Z.
+template< typename Send >
+void StartListing( const Command& cmd, Session& session, Send send )
+{
+    if( session.mode == ConnectionMode::Port )
+    {
+        session.connection.SendReply( notImplemented );
+        session.mode = ConnectionMode::Normal;
+        return;
+    }
+    else if( session.mode != ConnectionMode::Passive )
+    {
+        session.connection.SendReply( "425 use PASV or PORT first" );
+        return;
+    }
+
+    std::shared_ptr< Directory > dir;
+    try
+    {
+        // ls style options ('LIST -la') are not supported, list the cwd
+        dir = std::make_shared< Directory >( session.cwdFd.get(),
+                                cmd.arg[ 0 ] == '-' ? "" : cmd.arg.data() );
+    }
+    catch ( std::exception& ex )
+    {
+        PRINT_EX( ex );
+        session.ClosePassiveConn();
+        session.connection.SendReply( "550 failed to list directory" );
+        return;
+    }
+
+    auto& metrics = session.context.metrics;
+    bool modeZ = session.modeZ;
+    int level = session.deflateLevel;
+    auto worker = [ dir, send, modeZ, level, &metrics ](
+                        TcpConnection::pointer connection,
+                        tcp::socket& socket,
+                        const TransferWatch& )
+    {
+        try
+        {
+            connection->SendReply( "150 sending directory contents.." );
+            auto start = Metrics::Clock::now();
+            uint64_t sent = 0;
+            if( modeZ )
+            {
+                deflate::Writer writer { socket, level };
+                send( *dir, writer );
+                sent = writer.Finish();
+            }
+            else
+            {
+                sent = send( *dir, socket );
+            }
+            metrics.Transfer( Metrics::List, start, sent );
+            connection->SendReply( "226 directory contents sent" );
+        }
+        catch ( std::exception& ex )
+        {
+            PRINT_EX( ex );
+            connection->SendReply( "550 failed to list directory" );
+        }
+        return true;
+    };
+
+    StartTransfer( session, worker,
+                   Directory::flushSize +
+                   ( modeZ ? deflate::writerMemory : 0 ) );
+}
+
+// STOR/APPE. Without REST, STOR truncates the file and APPE writes at its
+// end; the truncation waits for the data connection so a STOR that never
+// gets one leaves the file alone. After REST the upload is written at the
+// restart offset without truncating, so several connections can each fill
+// their own segment of one file and an interrupted upload can be resumed.
+// A preceding ALLO reserves the space up front.
+void Upload( const Command& cmd, Session& session, bool append )
+{
+    if( ! ( session.mode == ConnectionMode::Passive) )
+    {
+        session.connection.SendReply(
+                "550 please use PASV instead of PORT" );
+        return;
+    }
+
+    int64_t offset = session.restartOffset;
+    uint64_t allocSize = session.allocSize;
+    session.restartOffset = -1;
+    session.allocSize = 0;
+
+    bool truncate = offset < 0 && ! append;
+    if( truncate )
+    {
+        offset = 0;
+    }
+
+    auto file = OpenFile( session, cmd.arg.data(), O_WRONLY | O_CREAT );
+    if( ! file )
+    {
+        session.connection.SendReply( "550 failed to transfer target file" );
+        return;
+    }
+
+    auto& metrics = session.context.metrics;
+    auto& transfers = session.context.transfers;
+    auto limits = session.RateLimits();
+    bool modeZ = session.modeZ;
+    auto worker = [ file, offset, truncate, allocSize, limits, modeZ,
+                    &metrics, &transfers,
+                    shaping = std::shared_ptr< Shaper::Transfer >(),
+                    receiver = std::shared_ptr< deflate::Receiver >(),
+                    start = Metrics::Clock::time_point(),
+                    position = uint64_t(), received = uint64_t() ](
+                        TcpConnection::pointer connection,
+                        tcp::socket& pasvSocket,
+                        TransferWatch& watch ) mutable
+    {
+        //TODO: implement ABOR
+        try
+        {
+            if( ! shaping )
+            {
+                if( truncate && -1 == ::ftruncate( file->get(), 0 ) )
+                {
+                    throw std::runtime_error { "could not truncate file" };
+                }
+
+                position = offset;
+                if( offset < 0 ) // APPE
+                {
+                    struct stat statbuf;
+                    if( -1 == ::fstat( file->get(), &statbuf ) )
+                    {
+                        throw std::runtime_error { "could not stat file" };
+                    }
+                    position = statbuf.st_size;
+                }
+
+                // keep the size as is so a partial upload still shows how
+                // far it got; filesystems without fallocate just skip this
+                if( allocSize &&
+                    -1 == ::fallocate( file->get(), FALLOC_FL_KEEP_SIZE, 0,
+                                       allocSize ) &&
+                    errno != EOPNOTSUPP )
+                {
+                    PRINT_ERR_STR( ::strerror( errno ) );
+                }
+
+                connection->SendReply(
+                            "125 data connection open, staring transfer" );
+
+                shaping = std::make_shared< Shaper::Transfer >( limits );
+                start = Metrics::Clock::now();
+                if( modeZ )
+                {
+                    receiver = std::make_shared< deflate::Receiver >(
+                                                    file->get(), position );
+                }
+            }
+
+            if( receiver )
+            {
+                receiver->Receive( pasvSocket, Shaped( *shaping ) );
+                received = receiver->written();
+            }
+            else
+            {
+                received += transfer::ReceiveFile( pasvSocket, file->get(),
+                                                   position + received,
+                                                   Shaped( *shaping ) );
+            }
+            if( Deferred( *shaping, transfers, watch ) )
+            {
+                return false;
+            }
+
+            // a stalled connection was shut down, which looks like the end
+            // of the upload
+            if( watch.stalled() )
+            {
+                throw transfer::DataConnectionError {
+                    "data connection stalled"
+                };
+            }
+            metrics.Transfer( Metrics::Stor, start, received );
+
+            // close before replying so the client never sees a partial file
+            file->reset();
+            connection->SendReply( "226 file sent successfully" );
+        }
+        catch( transfer::DataConnectionError& ex )
+        {
+            PRINT_EX( ex );
+            connection->SendReply( "426 data connection closed" );
+        }
+        catch ( std::exception& ex )
+        {
+            PRINT_EX( ex );
+            connection->SendReply( "550 failed to transfer target file" );
+        }
+        return true;
+    };
+
+    StartTransfer( session, worker, modeZ ? deflate::receiveMemory
+                                          : transfer::receiveMemory );
+}
+
+// 'SITE RATE' shows the bandwidth limits that apply to the session,
+// 'SITE RATE SESSION|USER|GLOBAL <bytes/s>' changes one of them, 0 lifts
+// it. Without --site-admin a session may only stay within its configured
+// --session-rate; the user and global limits affect other sessions too and
+// can't be changed at all.
+void SiteRate( boost::string_view arg, Session& session )
+{
+    auto& shaper = session.context.shaper;
+    if( arg.empty() )
+    {
+        session.connection.SendReply(
+            ( boost::format( "200 rate limits in bytes/s (0 = none): "
+                             "session %d, user %d, global %d" )
+                             % session.rateLimit->Rate()
+                             % shaper.User( session.user )->Rate()
+                             % shaper.Global()->Rate() ).str() );
+        return;
+    }
+
+    auto pos = arg.find( ' ' );
+    auto scope = arg.substr( 0, pos );
+    auto value = pos == boost::string_view::npos ? boost::string_view()
+                                                 : arg.substr( pos + 1 );
+    uint64_t rate = 0;
+    if( value.empty() || ParseNumber( value, rate ) != value.size() )
+    {
+        session.connection.SendReply( "501 usage: SITE RATE "
+                                      "[SESSION|USER|GLOBAL <bytes/s>]" );
+        return;
+    }
+
+    const auto& config = session.context.config;
+    if( boost::iequals( scope, "SESSION" ) )
+    {
+        if( ! config.siteAdmin && config.sessionRate != 0 &&
+            ( rate == 0 || rate > config.sessionRate ) )
+        {
+            session.connection.SendReply(
+                ( boost::format( "550 permission denied, the session rate "
+                                 "can only be set to 1-%d" )
+                                 % config.sessionRate ).str() );
+            return;
+        }
+        session.rateLimit->SetRate( rate );
+    }
+    else if( ! boost::iequals( scope, "USER" ) &&
+             ! boost::iequals( scope, "GLOBAL" ) )
+    {
+        session.connection.SendReply( "501 unknown rate limit" );
+        return;
+    }
+    else if( ! config.siteAdmin )
+    {
+        session.connection.SendReply( "550 permission denied" );
+        return;
+    }
+    else if( boost::iequals( scope, "USER" ) )
+    {
+        shaper.SetUserRate( rate );
+    }
+    else
+    {
+        shaper.Global()->SetRate( rate );
+    }
+
+    session.connection.SendReply( "200 rate limit changed" );
+}
+
+// 'OPTS MODE Z LEVEL <0-9>' picks the compression level of the following
+// MODE Z transfers
+void OptsModeZ( boost::string_view arg, Session& session )
+{
+    const boost::string_view prefix = "Z LEVEL ";
+    uint64_t level = 0;
+    if( arg.size() <= prefix.size() ||
+        ! boost::iequals( arg.substr( 0, prefix.size() ), prefix ) ||
+        ParseNumber( arg.substr( prefix.size() ), level ) !=
+                                            arg.size() - prefix.size() ||
+        level > 9 )
+    {
+        session.connection.SendReply(
+                "501 usage: OPTS MODE Z LEVEL <0-9>" );
+        return;
+    }
+
+    session.deflateLevel = (int)level;
+    session.connection.SendReply(
+            "200 MODE Z LEVEL set to " + std::to_string( level ) );
+}
+
+// 'OPTS HASH' shows the HASH algorithm, 'OPTS HASH <name>' picks another
+void OptsHash( boost::string_view arg, Session& session )
+{
+    if( ! arg.empty() &&
+        ! checksum::Parse( arg, session.hashAlgorithm ) )
+    {
+        session.connection.SendReply( "501 unknown hash algorithm" );
+        return;
+    }
+
+    session.connection.SendReply(
+            std::string( "200 " ) + checksum::Name( session.hashAlgorithm ) );
+}
+
+// Splits '<path> [<begin> [<end>]]' of the X* checksum verbs. A path is
+// quoted if it has spaces and is followed by a range; unquoted, trailing
+// numbers are taken as the range.
+bool ParseChecksumArg( boost::string_view arg, std::string& path,
+                       uint64_t& begin, uint64_t& end )
 {
-    for( auto handler : CommanList )
+    boost::string_view name = arg;
+    boost::string_view range;
+    if( ! arg.empty() && arg[ 0 ] == '"' )
     {
-        if( cmd.command != handler.name )
+        auto quote = arg.find( '"', 1 );
+        if( quote == boost::string_view::npos )
         {
-            continue;
+            return false;
         }
+        name  = arg.substr( 1, quote - 1 );
+        range = arg.substr( quote + 1 );
+    }
+    else
+    {
+        for( int i = 0; i < 2; ++i )
+        {
+            auto space = name.rfind( ' ' );
+            uint64_t value = 0;
+            if( space == boost::string_view::npos ||
+                space + 1 == name.size() ||
+                ParseNumber( name.substr( space + 1 ), value ) !=
+                                                name.size() - space - 1 )
+            {
+                break;
+            }
+            name  = name.substr( 0, space );
+            range = arg.substr( space );
+        }
+    }
 
-        if( handler.authType == Auth::MustLogIn && ! session.authenticated )
+    begin = 0;
+    end   = std::numeric_limits< uint64_t >::max();
+    uint64_t* bounds[] { &begin, &end };
+    for( auto bound : bounds )
+    {
+        while( ! range.empty() && range[ 0 ] == ' ' )
+        {
+            range.remove_prefix( 1 );
+        }
+        if( range.empty() )
+        {
+            break;
+        }
+        auto len = ParseNumber( range, *bound );
+        if( ! len || ( len < range.size() && range[ len ] != ' ' ) )
         {
-            session.connection.SendReply( "530  not logged in" );
+            return false;
         }
+        range.remove_prefix( len );
+    }
+
+    path.assign( name.data(), name.size() );
+    return ! path.empty() && range.empty() && begin <= end;
+}
 
-        handler.invoke( cmd, session );
+// Replies with the checksum of the bytes 'begin' up to 'end' (exclusive,
+// clipped to the file size) of 'path'. Hashing a big file takes a while,
+// so the digest is computed on the transfer threads; HASH replies with 213
+// and the range, the X* verbs with 250 and just the digest.
+void Checksum( Session& session, const std::string& path,
+               checksum::Algorithm algorithm, uint64_t begin, uint64_t end,
+               bool hashReply )
+{
+    auto file = std::make_shared< FileDescriptor >(
+                    ::openat( session.cwdFd.get(), path.c_str(),
+                              O_RDONLY | O_CLOEXEC ) );
+    if( ! *file )
+    {
+        session.connection.SendReply( "550 failed to open file" );
         return;
     }
 
-    session.connection.SendReply( "500 unknown command" );
+    auto connection = session.connection.get();
+    auto busy = connection->Busy();
+    session.PostTransfer( [ file, connection, busy, path, algorithm, begin,
+                            end, hashReply ]() {
+        try
+        {
+            struct stat statbuf;
+            if( -1 == ::fstat( file->get(), &statbuf ) ||
+                ! S_ISREG( statbuf.st_mode ) )
+            {
+                connection->SendReply( "550 not a plain file" );
+                return;
+            }
+
+            auto last = std::min< uint64_t >( end, statbuf.st_size );
+            if( begin > last )
+            {
+                connection->SendReply( "554 invalid range" );
+                return;
+            }
+
+            auto digest = checksum::Digest( file->get(), algorithm, begin,
+                                            last - begin );
+            if( hashReply )
+            {
+                connection->SendReply(
+                    ( boost::format( "213 %s %d-%d %s %s" )
+                                     % checksum::Name( algorithm )
+                                     % begin % last % digest % path ).str() );
+            }
+            else
+            {
+                connection->SendReply( "250 " + digest );
+            }
+        }
+        catch( std::exception& ex )
+        {
+            PRINT_EX( ex );
+            connection->SendReply( "550 failed to compute checksum" );
+        }
+    }, checksum::memory );
+}
+
+void XChecksum( const Command& cmd, Session& session,
+                checksum::Algorithm algorithm )
+{
+    std::string path;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    if( ! ParseChecksumArg( cmd.arg, path, begin, end ) )
+    {
+        session.connection.SendReply(
+                "501 usage: <path> [<start> [<end>]]" );
+        return;
+    }
+
+    Checksum( session, path, algorithm, begin, end, false );
+}
+
+} // namespace
+
+void ProcessCommand( const Command& cmd, Session& session)
+{
+    auto start = Metrics::Clock::now();
+    auto& metrics = session.context.metrics;
+
+    auto handler = FindCommand( cmd.command );
+    if( ! handler )
+    {
+        session.connection.SendReply( "500 unknown command" );
+        metrics.Command( commandCount, start );
+        return;
+    }
+
+    if( handler->authType == Auth::MustLogIn && ! session.authenticated )
+    {
+        session.connection.SendReply( "530 not logged in" );
+    }
+    else
+    {
+        handler->invoke( cmd, session );
+    }
+    metrics.Command( handler - CommanList, start );
+}
+
+std::vector< std::string > CommandNames()
+{
+    std::vector< std::string > names;
+    for( const auto& command : CommanList )
+    {
+        names.push_back( command.name );
+    }
+    return names;
 }
 
 void user( const Command& cmd, Session& session )
@@ -116,8 +831,8 @@ void user( const Command& cmd, Session& session )
     auto it = std::find( std::begin( usernames ), end , cmd.arg );
     if( it != end )
     {
-        session.user = cmd.arg;
-        session.connection.SendReply( "331 user name " + cmd.arg );
+        session.user.assign( cmd.arg.data(), cmd.arg.size() );
+        session.connection.SendReply( "331 user name " + session.user );
     }
     else
     {
@@ -141,66 +856,228 @@ void pass( const Command&, Session& session )
 
 void pasv( const Command&, Session& session )
 {
-    Port port;
+    if( session.epsvAll )
+    {
+        session.connection.SendReply( "501 PASV not allowed after EPSV ALL" );
+        return;
+    }
 
-    session.pasvPtr.reset(
-        new tcp::acceptor (
-            session.connection.socket().get_io_service(),
-            tcp::endpoint( tcp::v4(), port.value() )
-        )
-    );
+    // the address the client reached us on, PASV only speaks IPv4
+    auto local = LocalAddress( session );
+    if( ! local.is_v4() )
+    {
+        session.connection.SendReply( "522 PASV is IPv4 only, use EPSV" );
+        return;
+    }
+
+    uint16_t port = 0;
+    if( ! OpenPassive( session, port ) )
+    {
+        return;
+    }
 
-    auto ip = session.connection.socket().remote_endpoint()
-                                            .address().to_v4().to_bytes();
+    auto ip = local.to_v4().to_bytes();
     session.connection.SendReply(
         ( boost::format( "227 entering passive mode (%d,%d,%d,%d,%d,%d)" )
                         % (int)ip[0] % (int)ip[1] % (int)ip[2] % (int)ip[3]
-                        % port.p1 % port.p2
+                        % ( port >> 8 ) % ( port & 0xff )
         ).str()
     );
+}
 
-    session.mode = ConnectionMode::Passive;
+// RFC 2428, the client connects to the control connection's address
+void epsv( const Command& cmd, Session& session )
+{
+    if( boost::iequals( cmd.arg, "ALL" ) )
+    {
+        session.epsvAll = true;
+        session.connection.SendReply( "200 EPSV ALL ok" );
+        return;
+    }
+    // network protocol 1 is IPv4, 2 IPv6
+    const char* protocol = LocalAddress( session ).is_v4() ? "1" : "2";
+    if( ! cmd.arg.empty() && cmd.arg != protocol )
+    {
+        session.connection.SendReply(
+            ( boost::format( "522 network protocol not supported, use (%s)" )
+                             % protocol ).str() );
+        return;
+    }
+
+    uint16_t port = 0;
+    if( OpenPassive( session, port ) )
+    {
+        session.connection.SendReply(
+            "229 entering extended passive mode (|||" +
+            std::to_string( port ) + "|)" );
+    }
 }
 
 void list( const Command& cmd, Session& session)
 {
-    try
+    auto& cache = session.context.listings;
+    StartListing( cmd, session, [ &cache ]( Directory& dir, auto& stream ) {
+        return dir.List( stream, cache );
+    } );
+}
+
+void nlst( const Command& cmd, Session& session )
+{
+    StartListing( cmd, session, []( Directory& dir, auto& stream ) {
+        return dir.SendNames( stream );
+    } );
+}
+
+void mlsd( const Command& cmd, Session& session )
+{
+    auto facts = session.mlstFacts;
+    StartListing( cmd, session, [ facts ]( Directory& dir,
+                                           auto& stream ) {
+        return dir.SendFacts( stream, facts );
+    } );
+}
+
+// 'MODE S' sends data as is, 'MODE Z' deflate compressed
+void mode( const Command& cmd, Session& session )
+{
+    if( boost::iequals( cmd.arg, "S" ) )
     {
-        if( session.mode == ConnectionMode::Passive )
-        {
-            WorkingDirChanger dirChanger{ cmd.arg };
-            Directory dir { dirChanger.GetCWD() };
-            dir.List( session );
-        }
-        else if( session.mode == ConnectionMode::Port )
-        {
-            session.connection.SendReply( notImplemented );
-        }
-        else
+        session.modeZ = false;
+        session.connection.SendReply( "200 switched to stream mode" );
+    }
+    else if( boost::iequals( cmd.arg, "Z" ) )
+    {
+        session.modeZ = true;
+        session.connection.SendReply( "200 switched to deflate mode" );
+    }
+    else
+    {
+        session.connection.SendReply( "504 unsupported transfer mode" );
+    }
+}
+
+void mlst( const Command& cmd, Session& session )
+{
+    boost::string_view path = cmd.arg.empty() ? "." : cmd.arg;
+
+    EntryStat st;
+    if( ! StatEntry( session.cwdFd.get(), path.data(), st ) )
+    {
+        session.connection.SendReply( "550 no such file or directory" );
+        return;
+    }
+
+    std::string reply = "250-Listing ";
+    reply.append( path.data(), path.size() );
+    reply += "\r\n ";
+    AppendFacts( reply, session.mlstFacts, &st, DT_UNKNOWN,
+                 path.data(), path.size() );
+    reply += "\r\n250 End";
+    session.connection.SendReply( reply );
+}
+
+void opts( const Command& cmd, Session& session )
+{
+    auto pos = cmd.arg.find( ' ' );
+    if( boost::iequals( cmd.arg.substr( 0, pos ), "HASH" ) )
+    {
+        OptsHash( pos == boost::string_view::npos
+                        ? boost::string_view() : cmd.arg.substr( pos + 1 ),
+                  session );
+        return;
+    }
+    if( boost::iequals( cmd.arg.substr( 0, pos ), "MODE" ) )
+    {
+        OptsModeZ( pos == boost::string_view::npos
+                        ? boost::string_view() : cmd.arg.substr( pos + 1 ),
+                   session );
+        return;
+    }
+    if( ! boost::iequals( cmd.arg.substr( 0, pos ), "MLST" ) )
+    {
+        session.connection.SendReply( "501 option not understood" );
+        return;
+    }
+
+    // 'OPTS MLST size;modify;' selects the facts MLSD/MLST report, facts
+    // we don't know are ignored
+    std::vector< std::string > requested;
+    if( pos != boost::string_view::npos )
+    {
+        auto list = cmd.arg.substr( pos + 1 ).to_string();
+        boost::to_lower( list );
+        boost::split( requested, list, boost::is_any_of( ";" ) );
+    }
+
+    unsigned facts = 0;
+    std::string enabled;
+    for( const auto& fact : mlst::names )
+    {
+        if( std::find( requested.begin(), requested.end(), fact.name ) !=
+            requested.end() )
         {
-            session.connection.SendReply( "425 use PASV or PORT first" );
+            facts |= fact.fact;
+            enabled += fact.name;
+            enabled += ';';
         }
     }
-    catch ( std::exception& ex )
+
+    session.mlstFacts = facts;
+    session.connection.SendReply( "200 MLST OPTS " + enabled );
+}
+
+void feat( const Command&, Session& session )
+{
+    std::string mlstFacts;
+    for( const auto& fact : mlst::names )
     {
-        PRINT_EX( ex );
-        session.connection.SendReply( "550 failed to list directory" );
+        mlstFacts += fact.name;
+        mlstFacts += ( session.mlstFacts & fact.fact ) ? "*;" : ";";
+    }
+
+    std::string hashes;
+    for( auto algorithm : checksum::algorithms )
+    {
+        hashes += checksum::Name( algorithm );
+        hashes += algorithm == session.hashAlgorithm ? "*;" : ";";
     }
 
-    session.mode = ConnectionMode::Normal;
+    std::string reply = "211-Features:\r\n";
+    reply += " MLST " + mlstFacts + "\r\n";
+    reply += " HASH " + hashes + "\r\n";
+    for( auto feature : features )
+    {
+        reply += ' ';
+        reply += feature;
+        reply += "\r\n";
+    }
+    reply += "211 End";
+
+    session.connection.SendReply( reply );
+}
+
+// draft-bryan-ftpext-hash, whole files with the algorithm of OPTS HASH
+void hash( const Command& cmd, Session& session )
+{
+    if( cmd.arg.empty() )
+    {
+        session.connection.SendReply( "501 usage: HASH <path>" );
+        return;
+    }
+
+    Checksum( session, cmd.arg.to_string(), session.hashAlgorithm, 0,
+              std::numeric_limits< uint64_t >::max(), true );
 }
 
 void quit( const Command&, Session& session )
 {
-    session.connection.SendReply< ReplyType::NoResponse >( "221 bye" );
+    session.connection.SendReply< ReplyType::Close >( "221 bye" );
 }
 
 void pwd( const Command&, Session& session )
 {
     session.connection.SendReply(
-            ( boost::format( "257 \"%s\"" )
-                             % WorkingDirChanger::GetCWD()
-            ).str()
+            ( boost::format( "257 \"%s\"" ) % session.cwd ).str()
     );
 }
 
@@ -208,7 +1085,7 @@ void cwd( const Command& cmd, Session& session )
 {
     try
     {
-        WorkingDirChanger::CWD( cmd.arg );
+        session.ChangeDir( cmd.arg.data() );
         session.connection.SendReply( "250 directory changed" );
         return;
     }
@@ -221,7 +1098,7 @@ void cwd( const Command& cmd, Session& session )
 
 void mkd( const Command& cmd, Session& session)
 {
-    if( ::mkdir( cmd.arg.c_str(), S_IRWXU ) == 0 )
+    if( ::mkdirat( session.cwdFd.get(), cmd.arg.data(), S_IRWXU ) == 0 )
     {
         if( cmd.arg[0] == '/' ) // absolute path
         {
@@ -233,8 +1110,9 @@ void mkd( const Command& cmd, Session& session)
         else
         {
             session.connection.SendReply(
-                    ( boost::format( "257 \"%s/%s\" directory created" )
-                                   % WorkingDirChanger::GetCWD()
+                    ( boost::format( "257 \"%s%s%s\" directory created" )
+                                   % session.cwd
+                                   % ( session.cwd == "/" ? "" : "/" )
                                    % cmd.arg ).str()
             );
         }
@@ -254,135 +1132,199 @@ void retr( const Command& cmd, Session& session )
         return;
     }
 
-    auto worker = [ cmd ]( TcpConnection::pointer connection,
-                      tcp::socket pasvSocket )
+    // REST applies to this transfer only
+    uint64_t offset = std::max< int64_t >( session.restartOffset, 0 );
+    session.restartOffset = -1;
+
+    // popular small files are sent from the file cache, a hit costs a stat
+    // of the path but no open or read
+    auto& files = session.context.files;
+    FileCache::Data cached;
+    struct stat pathStat {};
+    bool admit = false;
+    if( files.enabled() &&
+        0 == ::fstatat( session.cwdFd.get(), cmd.arg.data(), &pathStat, 0 ) &&
+        S_ISREG( pathStat.st_mode ) )
     {
-        try
-        {
-            SocketCloser< tcp::socket > sockCloser{ pasvSocket };
+        cached = files.Find( pathStat, admit );
+    }
 
-            std::vector< char > buf ( buffSize );
-            boost::system::error_code error;
+    FilePtr file;
+    if( ! cached )
+    {
+        file = OpenFile( session, cmd.arg.data(), O_RDONLY );
+        if( ! file )
+        {
+            session.connection.SendReply( "550 failed to download file" );
+            return;
+        }
+    }
 
-            std::ifstream file( cmd.arg.c_str() );
-            if( !file )
+    auto& metrics = session.context.metrics;
+    auto& compression = session.context.compression;
+    auto& transfers = session.context.transfers;
+    auto limits = session.RateLimits();
+    bool modeZ = session.modeZ;
+    int level = session.deflateLevel;
+    auto name = cmd.arg.to_string();
+    auto worker = [ file, cached, pathStat, admit, offset, limits, modeZ,
+                    level, name, &metrics, &compression, &files, &transfers,
+                    data = FileCache::Data(),
+                    shaping = std::shared_ptr< Shaper::Transfer >(),
+                    sender = std::shared_ptr< deflate::Sender >(),
+                    start = Metrics::Clock::time_point(),
+                    count = uint64_t(), sent = uint64_t() ](
+                        TcpConnection::pointer connection,
+                        tcp::socket& pasvSocket,
+                        TransferWatch& watch ) mutable
+    {
+        try
+        {
+            if( ! shaping )
             {
-                throw std::runtime_error { "could not open file" };
-            }
+                // popular enough now, later downloads come from memory
+                data = cached;
+                if( ! data && admit )
+                {
+                    data = files.Load( file->get(), pathStat );
+                }
 
-            connection->SendReply(
-                    "150 opening BINARY mode data connection" );
+                struct stat statbuf;
+                if( data )
+                {
+                    statbuf.st_size = data->size();
+                }
+                else if( -1 == ::fstat( file->get(), &statbuf ) )
+                {
+                    throw std::runtime_error { "could not stat file" };
+                }
+                if( offset > (uint64_t)statbuf.st_size )
+                {
+                    connection->SendReply(
+                            "554 restart offset is past the end of file" );
+                    return true;
+                }
+                count = statbuf.st_size - offset;
 
-            auto bytesLeft = boost::filesystem::file_size( cmd.arg.c_str() );
-            while( bytesLeft > 0 && ! error  )
-            {
-                auto n = bytesLeft > buffSize ? buffSize : bytesLeft;
-                file.read( buf.data(), n );
-                bytesLeft -= n;
+                connection->SendReply(
+                        "150 opening BINARY mode data connection" );
 
-                boost::asio::write( pasvSocket,
-                                    boost::asio::buffer( buf, n ),
-                                    error );
+                shaping = std::make_shared< Shaper::Transfer >( limits );
+                start = Metrics::Clock::now();
+                // archives, media.. are sent stored rather than recompressed
+                if( modeZ && data )
+                {
+                    bool stored = deflate::Incompressible(
+                                name.c_str(), data->data(), data->size() );
+                    sender = std::make_shared< deflate::Sender >(
+                                data->data() + offset, count,
+                                stored ? 0 : level );
+                }
+                else if( modeZ )
+                {
+                    bool stored = deflate::Incompressible( name.c_str(),
+                                                           file->get() );
+                    sender = std::make_shared< deflate::Sender >(
+                                file->get(), offset, count,
+                                stored ? 0 : level, compression );
+                }
             }
 
-            if( error )
+            if( sender )
             {
-                throw std::runtime_error {
-                    ( boost::format( "error transfering file: %s" )
-                                     % error.message()
-
-                    ).str()
-                };
+                sender->Send( pasvSocket, Shaped( *shaping ) );
+                sent = sender->sent();
+            }
+            else if( data )
+            {
+                // a single write in stream mode
+                sent += transfer::SendBuffer( pasvSocket,
+                                              data->data() + offset + sent,
+                                              count - sent,
+                                              Shaped( *shaping ) );
+            }
+            else
+            {
+                sent += transfer::SendFile( pasvSocket, file->get(),
+                                            offset + sent, count - sent,
+                                            Shaped( *shaping ) );
+            }
+            if( Deferred( *shaping, transfers, watch ) )
+            {
+                return false;
             }
+            metrics.Transfer( Metrics::Retr, start, sent );
 
             connection->SendReply(
                     "226 file downloaded successfully" );
         }
+        catch( transfer::DataConnectionError& ex )
+        {
+            // e.g. a segmented download closing once it has its range
+            PRINT_EX( ex );
+            connection->SendReply( "426 data connection closed" );
+        }
         catch( std::exception& ex )
         {
             PRINT_EX( ex );
             connection->SendReply( "550 failed to download file" );
         }
-
+        return true;
     };
 
-    session.workers.emplace_back( worker, session.connection.get(),
-            session.AcceptPassiveConn() );
+    // a cached file needs no buffers besides the compressor's, one about to
+    // be cached is held in memory as a whole
+    size_t memory = modeZ ? deflate::sendMemory : transfer::sendMemory;
+    if( cached )
+    {
+        memory = modeZ ? deflate::writerMemory : 0;
+    }
+    else if( admit )
+    {
+        memory += pathStat.st_size;
+    }
+    StartTransfer( session, worker, memory );
 }
 
 void stor( const Command& cmd, Session& session)
 {
-    if( ! ( session.mode == ConnectionMode::Passive) )
+    Upload( cmd, session, false );
+}
+
+void appe( const Command& cmd, Session& session )
+{
+    Upload( cmd, session, true );
+}
+
+void allo( const Command& cmd, Session& session )
+{
+    // 'ALLO <size> [R <record size>]', records don't apply to files
+    uint64_t size = 0;
+    auto pos = ParseNumber( cmd.arg, size );
+    if( pos && ( pos == cmd.arg.size() || cmd.arg[ pos ] == ' ' ) )
     {
-        session.connection.SendReply(
-                "550 please use PASV instead of PORT" );
+        session.allocSize = size;
+        session.connection.SendReply( "200 ALLO command successful" );
         return;
     }
 
-    auto worker = [ cmd ]( TcpConnection::pointer connection,
-                           tcp::socket pasvSocket )
-    {
-        //TODO: implement ABOR
-        try
-        {
-            SocketCloser< tcp::socket > sockCloser{ pasvSocket };
-
-            std::ofstream file( cmd.arg.c_str() );
-            if( !file )
-            {
-                throw std::runtime_error {
-                    ( boost::format( "error creating file: %s" )
-                                     % cmd.arg.c_str()
-
-                    ).str()
-                };
-            }
-
-            connection->SendReply< ReplyType::NoResponse >(
-                            "125 data connection open, staring transfer" );
-
-            boost::asio::streambuf buffer;
-            boost::system::error_code error;
-            while( ! error )
-            {
-                auto transfered = boost::asio::read(
-                                    pasvSocket,
-                                    buffer,
-                                    boost::asio::transfer_exactly( buffSize ),
-                                    error );
-                if( ! transfered )
-                {
-                    break;
-                }
-
-                file.write( boost::asio::buffer_cast< const char * >(
-                                                buffer.data() ), transfered );
-                buffer.consume( transfered );
-            }
-            if( error && error != boost::asio::error::eof )
-            {
-                throw std::runtime_error {
-                    ( boost::format( "error transfering file: %s" )
-                                     % error.message()
-
-                    ).str()
-                };
-            }
-            connection->SendReply( "226 file sent successfully" );
+    session.connection.SendReply( "501 invalid ALLO size" );
+}
 
-            // TODO: for linux systems use copy_file_range for in-kernel
-            // file copy = better performance
-            // http://man7.org/linux/man-pages/man2/copy_file_range.2.html
-        }
-        catch ( std::exception& ex )
-        {
-            PRINT_EX( ex );
-            connection->SendReply( "550 failed to transfer target file" );
-        }
-    };
+void rest( const Command& cmd, Session& session )
+{
+    uint64_t offset = 0;
+    auto pos = ParseNumber( cmd.arg, offset );
+    if( pos && pos == cmd.arg.size() &&
+        offset <= (uint64_t)std::numeric_limits< int64_t >::max() )
+    {
+        session.restartOffset = (int64_t)offset;
+        session.connection.SendReply(
+                "350 restarting at " + std::to_string( offset ) );
+        return;
+    }
 
-    session.workers.emplace_back( worker, session.connection.get(),
-            session.AcceptPassiveConn() );
+    session.connection.SendReply( "501 invalid restart offset" );
 }
 
 void abor( const Command&, Session& session )
@@ -410,64 +1352,96 @@ void type( const Command& cmd, Session& session )
 
 void dele( const Command& cmd, Session& session )
 {
-    try
-    {
-        boost::system::error_code ec;
-        if( boost::filesystem::remove( cmd.arg, ec ) )
-        {
-            session.connection.SendReply( "250 file was removed" );
-            return;
-        }
-
-        PRINT_ERR_STR( ec.message() );
-    }
-    catch ( std::exception& ex )
+    if( 0 == ::unlinkat( session.cwdFd.get(), cmd.arg.data(), 0 ) )
     {
-        PRINT_EX( ex );
+        session.connection.SendReply( "250 file was removed" );
+        return;
     }
 
+    PRINT_ERR_STR( ::strerror( errno ) );
     session.connection.SendReply( "550 error file directory" );
 }
 
 void rmd( const Command& cmd, Session& session )
 {
-    try
-    {
-        boost::system::error_code ec;
-        if( boost::filesystem::remove( cmd.arg, ec ) )
-        {
-            session.connection.SendReply( "250 directory was removed" );
-            return;
-        }
-
-        PRINT_ERR_STR( ec.message() );
-    }
-    catch ( std::exception& ex )
+    if( 0 == ::unlinkat( session.cwdFd.get(), cmd.arg.data(),
+                         AT_REMOVEDIR ) )
     {
-        PRINT_EX( ex );
+        session.connection.SendReply( "250 directory was removed" );
+        return;
     }
 
+    PRINT_ERR_STR( ::strerror( errno ) );
     session.connection.SendReply( "550 error deleting directory" );
 }
 
 void size( const Command& cmd, Session& session )
 {
-    try
+    struct stat statbuf;
+    if( 0 == ::fstatat( session.cwdFd.get(), cmd.arg.data(), &statbuf, 0 )
+        && S_ISREG( statbuf.st_mode ) )
     {
         session.connection.SendReply( "213 " +
-            std::to_string( boost::filesystem::file_size( cmd.arg.c_str() ) )
-        );
+                                      std::to_string( statbuf.st_size ) );
     }
-    catch ( std::exception& ex )
+    else
     {
         session.connection.SendReply( "550 failed to get file size" );
     }
 }
 
+void site( const Command& cmd, Session& session )
+{
+    auto pos = cmd.arg.find( ' ' );
+    auto sub = cmd.arg.substr( 0, pos );
+
+    if( boost::iequals( sub, "STATS" ) )
+    {
+        // one reply line per metrics line, indented as RFC 959 asks for
+        // multi-line replies
+        std::string reply = "211-Server statistics:\r\n";
+        auto text = session.context.metrics.Render();
+        for( size_t begin = 0, end; begin < text.size(); begin = end + 1 )
+        {
+            end = std::min( text.find( '\n', begin ), text.size() );
+            reply += ' ';
+            reply.append( text, begin, end - begin );
+            reply += "\r\n";
+        }
+        reply += "211 End";
+        session.connection.SendReply( reply );
+        return;
+    }
+    if( boost::iequals( sub, "RATE" ) )
+    {
+        SiteRate( pos == boost::string_view::npos ? boost::string_view()
+                                                  : cmd.arg.substr( pos + 1 ),
+                  session );
+        return;
+    }
+
+    session.connection.SendReply( "501 unknown SITE command" );
+}
+
 void noop( const Command&, Session& session )
 {
     session.connection.SendReply( "200 noop" );
 }
 
+void xcrc( const Command& cmd, Session& session )
+{
+    XChecksum( cmd, session, checksum::Algorithm::Crc32 );
+}
+
+void xmd5( const Command& cmd, Session& session )
+{
+    XChecksum( cmd, session, checksum::Algorithm::Md5 );
+}
+
+void xsha256( const Command& cmd, Session& session )
+{
+    XChecksum( cmd, session, checksum::Algorithm::Sha256 );
+}
+
 } // namespace ftp
 } // namespace ttf
@@ -2,12 +2,17 @@
 
 #include "Command.hpp"
 #include "Session.hpp"
+#include <string>
+#include <vector>
 
 namespace fcpp
 {
 namespace ftp
 {
 void ProcessCommand( const Command& cmd, Session& session);
+
+// verbs in the order ProcessCommand reports them to Metrics::Command
+std::vector< std::string > CommandNames();
 void OutputResponse( Session& );
 
 void user( const Command&, Session& );
@@ -17,13 +22,28 @@ void cwd( const Command&, Session& );
 void mkd( const Command&, Session& );
 void rmd( const Command&, Session& );
 void pasv( const Command&, Session& );
+void epsv( const Command&, Session& );
 void list( const Command&, Session& );
+void nlst( const Command&, Session& );
+void mlsd( const Command&, Session& );
+void mlst( const Command&, Session& );
+void mode( const Command&, Session& );
+void opts( const Command&, Session& );
+void feat( const Command&, Session& );
+void hash( const Command&, Session& );
+void rest( const Command&, Session& );
 void retr( const Command&, Session& );
 void stor( const Command&, Session& );
+void appe( const Command&, Session& );
+void allo( const Command&, Session& );
 void dele( const Command&, Session& );
 void size( const Command&, Session& );
+void site( const Command&, Session& );
 void quit( const Command&, Session& );
 void type( const Command&, Session& );
+void xcrc( const Command&, Session& );
+void xmd5( const Command&, Session& );
+void xsha256( const Command&, Session& );
 void abor( const Command&, Session& );
 void noop( const Command&, Session& );
 
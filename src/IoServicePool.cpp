@@ -0,0 +1,85 @@
+#include "IoServicePool.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+namespace fcpp
+{
+
+namespace
+{
+void PinToCpu( size_t index )
+{
+    auto cpus = std::thread::hardware_concurrency();
+    if( 0 == cpus )
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( index % cpus, &set );
+    if( 0 != ::pthread_setaffinity_np( ::pthread_self(), sizeof( set ), &set ) )
+    {
+        PRINT_ERR_STR( "failed to pin reactor thread to cpu" );
+    }
+}
+} // namespace
+
+IoServicePool::IoServicePool( size_t size, bool pinThreads ) :
+    next_       {},
+    pinThreads_ { pinThreads }
+{
+    for( size_t i = 0; i < std::max< size_t >( size, 1 ); ++i )
+    {
+        services_.emplace_back( new boost::asio::io_service { 1 } );
+        work_.emplace_back(
+                new boost::asio::io_service::work { *services_.back() } );
+    }
+}
+
+void IoServicePool::run()
+{
+    std::vector< std::thread > threads;
+
+    for( size_t i = 1; i < services_.size(); ++i )
+    {
+        threads.emplace_back( [ this, i ]() {
+            if( pinThreads_ )
+            {
+                PinToCpu( i );
+            }
+            services_[ i ]->run();
+        } );
+    }
+
+    // the calling thread serves the first io_service
+    if( pinThreads_ )
+    {
+        PinToCpu( 0 );
+    }
+    services_[ 0 ]->run();
+
+    for( auto& thread : threads )
+    {
+        thread.join();
+    }
+}
+
+void IoServicePool::stop()
+{
+    work_.clear();
+    for( auto& service : services_ )
+    {
+        service->stop();
+    }
+}
+
+boost::asio::io_service& IoServicePool::next()
+{
+    return *services_[ next_++ % services_.size() ];
+}
+
+} // namespace ttf
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace fcpp
+{
+
+// A set of io_service instances, each run by exactly one thread. Everything
+// bound to one io_service (a connection, its session and its handlers) is
+// therefore serialized without locking, while separate connections spread
+// over all cores.
+class IoServicePool
+{
+public:
+    IoServicePool( size_t size, bool pinThreads );
+
+    IoServicePool( const IoServicePool& ) = delete;
+    IoServicePool& operator=( const IoServicePool& ) = delete;
+
+    // runs all io_services, blocks until they are stopped
+    void run();
+    void stop();
+
+    size_t size() const
+    {
+        return services_.size();
+    }
+
+    boost::asio::io_service& at( size_t index )
+    {
+        return *services_.at( index );
+    }
+
+    // round-robin pick of the io_service for a new connection
+    boost::asio::io_service& next();
+
+private:
+    typedef std::unique_ptr< boost::asio::io_service > ServicePtr;
+    typedef std::unique_ptr< boost::asio::io_service::work > WorkPtr;
+
+    std::vector< ServicePtr > services_;
+    std::vector< WorkPtr >    work_;
+    std::atomic< size_t >     next_;
+    bool                      pinThreads_;
+};
+
+} // namespace ttf
@@ -0,0 +1,208 @@
+#include "ListingCache.hpp"
+#include "Utils.hpp"
+#include <boost/format.hpp>
+#include <cerrno>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fcpp
+{
+
+namespace
+{
+// every watch costs kernel memory and counts against max_user_watches
+constexpr size_t maxEntries = 4096;
+
+constexpr uint32_t watchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |
+                               IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                               IN_MOVE_SELF | IN_ONLYDIR;
+
+bool operator!=( const timespec& a, const timespec& b )
+{
+    return a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec;
+}
+} // namespace
+
+ListingCache::ListingCache( size_t maxBytes ) :
+    maxBytes_   { maxBytes },
+    bytes_      {},
+    generation_ {}
+{
+    if( maxBytes_ )
+    {
+        inotify_.reset( ::inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) );
+        if( ! inotify_ )
+        {
+            PRINT_ERR_STR( "inotify unavailable, listing cache disabled" );
+        }
+    }
+}
+
+ListingCache::Listing ListingCache::Find( int dirfd, Ticket& ticket )
+{
+    ticket.generation = 0;
+
+    struct stat st;
+    if( ! inotify_ || -1 == ::fstat( dirfd, &st ) )
+    {
+        return nullptr;
+    }
+
+    std::lock_guard< std::mutex > lock { mutex_ };
+    DrainEvents();
+
+    Key key { st.st_dev, st.st_ino };
+    auto it = entries_.find( key );
+    if( it != entries_.end() )
+    {
+        auto& entry = it->second;
+        if( entry.mtime != st.st_mtim || entry.ctime != st.st_ctim )
+        {
+            Drop( it );
+        }
+        else if( entry.listing )
+        {
+            lru_.splice( lru_.begin(), lru_, entry.lru );
+            return entry.listing;
+        }
+        else
+        {
+            // somebody else is rendering it right now, render our own
+            // copy and let the newest one win
+            ticket = Ticket { key.dev, key.ino, entry.generation };
+            return nullptr;
+        }
+    }
+
+    auto path = ( boost::format( "/proc/self/fd/%d" ) % dirfd ).str();
+    int wd = ::inotify_add_watch( inotify_.get(), path.c_str(), watchMask );
+    if( -1 == wd )
+    {
+        return nullptr;
+    }
+
+    lru_.push_front( key );
+    entries_[ key ] = Entry {
+        wd, ++generation_, st.st_mtim, st.st_ctim, nullptr, lru_.begin()
+    };
+    watches_[ wd ] = key;
+    ticket = Ticket { key.dev, key.ino, generation_ };
+
+    Evict();
+    return nullptr;
+}
+
+void ListingCache::Insert( const Ticket& ticket, Listing listing )
+{
+    if( ! ticket.generation || listing->size() > MaxEntrySize() )
+    {
+        return;
+    }
+
+    std::lock_guard< std::mutex > lock { mutex_ };
+    DrainEvents();
+
+    auto it = entries_.find( Key { ticket.dev, ticket.ino } );
+    if( it == entries_.end() || it->second.generation != ticket.generation )
+    {
+        return; // evicted or changed while we were rendering
+    }
+
+    auto& entry = it->second;
+    if( entry.listing )
+    {
+        bytes_ -= entry.listing->size();
+    }
+    entry.listing = std::move( listing );
+    bytes_ += entry.listing->size();
+
+    Evict();
+}
+
+void ListingCache::DrainEvents()
+{
+    alignas( inotify_event ) char buf[ 16 * 1024 ];
+
+    for( ;; )
+    {
+        auto len = ::read( inotify_.get(), buf, sizeof( buf ) );
+        if( len <= 0 )
+        {
+            return; // EAGAIN, nothing (more) pending
+        }
+
+        for( char* p = buf; p < buf + len; )
+        {
+            auto event = reinterpret_cast< inotify_event* >( p );
+            p += sizeof( inotify_event ) + event->len;
+
+            if( event->mask & IN_Q_OVERFLOW )
+            {
+                // lost track of what changed
+                while( ! entries_.empty() )
+                {
+                    Drop( entries_.begin() );
+                }
+                continue;
+            }
+
+            auto watch = watches_.find( event->wd );
+            if( watch == watches_.end() )
+            {
+                continue;
+            }
+
+            auto it = entries_.find( watch->second );
+            if( event->mask & IN_IGNORED )
+            {
+                // the directory is gone, the kernel dropped the watch
+                watches_.erase( watch );
+                if( it != entries_.end() )
+                {
+                    it->second.wd = -1;
+                    Drop( it );
+                }
+                continue;
+            }
+
+            if( it != entries_.end() )
+            {
+                auto& entry = it->second;
+                if( entry.listing )
+                {
+                    bytes_ -= entry.listing->size();
+                    entry.listing.reset();
+                }
+                entry.generation = ++generation_;
+            }
+        }
+    }
+}
+
+void ListingCache::Drop( Entries::iterator it )
+{
+    auto& entry = it->second;
+    if( entry.wd != -1 )
+    {
+        ::inotify_rm_watch( inotify_.get(), entry.wd );
+        watches_.erase( entry.wd );
+    }
+    if( entry.listing )
+    {
+        bytes_ -= entry.listing->size();
+    }
+    lru_.erase( entry.lru );
+    entries_.erase( it );
+}
+
+void ListingCache::Evict()
+{
+    while( ! lru_.empty() &&
+           ( bytes_ > maxBytes_ || entries_.size() > maxEntries ) )
+    {
+        Drop( entries_.find( lru_.back() ) );
+    }
+}
+
+} // namespace ttf
@@ -0,0 +1,101 @@
+#pragma once
+#include "FileDescriptor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace fcpp
+{
+
+// Rendered LIST output of recently listed directories, shared by all
+// sessions and keyed by the directory's device/inode. Every cached
+// directory carries an inotify watch, so creating, removing, renaming or
+// modifying anything inside it drops the entry; the directory's mtime and
+// ctime are checked on each hit as well. Total size is capped, the least
+// recently used listings are evicted first.
+class ListingCache
+{
+public:
+    typedef std::shared_ptr< const std::string > Listing;
+
+    // identifies the directory version a listing is rendered from
+    struct Ticket
+    {
+        dev_t       dev;
+        ino_t       ino;
+        uint64_t    generation; // 0 = don't cache
+    };
+
+    explicit ListingCache( size_t maxBytes );
+
+    ListingCache( const ListingCache& ) = delete;
+    ListingCache& operator=( const ListingCache& ) = delete;
+
+    // Returns the cached listing of the open directory 'dirfd' if there is
+    // a valid one. Otherwise fills 'ticket' which must be passed to Insert
+    // with the freshly rendered listing.
+    Listing Find( int dirfd, Ticket& ticket );
+
+    // stores the listing unless the directory changed since Find
+    void Insert( const Ticket& ticket, Listing listing );
+
+    // largest listing worth keeping
+    size_t MaxEntrySize() const
+    {
+        return maxBytes_ / 4;
+    }
+
+private:
+    struct Key
+    {
+        dev_t dev;
+        ino_t ino;
+
+        bool operator==( const Key& other ) const
+        {
+            return dev == other.dev && ino == other.ino;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const Key& key ) const
+        {
+            return std::hash< uint64_t >()( key.ino ) ^
+                   ( std::hash< uint64_t >()( key.dev ) << 1 );
+        }
+    };
+
+    struct Entry
+    {
+        int                         wd;
+        uint64_t                    generation;
+        timespec                    mtime;
+        timespec                    ctime;
+        Listing                     listing;
+        std::list< Key >::iterator  lru;
+    };
+
+    typedef std::unordered_map< Key, Entry, KeyHash > Entries;
+
+    void DrainEvents();
+    void Drop( Entries::iterator it );
+    void Evict();
+
+    std::mutex                          mutex_;
+    const size_t                        maxBytes_;
+    size_t                              bytes_;
+    uint64_t                            generation_;
+    FileDescriptor                      inotify_;
+    Entries                             entries_;
+    std::unordered_map< int, Key >      watches_;
+    std::list< Key >                    lru_; // most recently used first
+};
+
+} // namespace ttf
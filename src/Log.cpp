@@ -0,0 +1,263 @@
+#include "Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace fcpp
+{
+namespace log
+{
+
+std::atomic< int > threshold { FCPP_LOG_LEVEL };
+
+namespace
+{
+constexpr size_t ringSize = 4096;   // messages, a power of two
+constexpr size_t textSize = 240;    // longer messages are truncated
+
+const char* const levelNames[] { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+struct Slot
+{
+    std::atomic< size_t > seq;
+    Level                 level;
+    timespec              time;
+    uint32_t              len;
+    char                  text[ textSize ];
+};
+
+// Bounded multi-producer queue (Vyukov): a slot whose sequence number
+// equals the write position is free, one past it holds a message.
+struct Ring
+{
+    Ring()
+    {
+        for( size_t i = 0; i < ringSize; ++i )
+        {
+            slots[ i ].seq.store( i, std::memory_order_relaxed );
+        }
+    }
+
+    Slot slots[ ringSize ];
+    alignas( 64 ) std::atomic< size_t >   writePos { 0 };
+    alignas( 64 ) std::atomic< uint64_t > dropped { 0 };
+    size_t readPos = 0; // flusher thread only
+};
+
+Ring& GetRing()
+{
+    static Ring ring;
+    return ring;
+}
+
+std::mutex              mutex;
+std::condition_variable cond;
+bool                    stopping = false;
+std::thread             thread;
+
+void WriteAll( int fd, std::string& data )
+{
+    size_t done = 0;
+    while( done < data.size() )
+    {
+        auto n = ::write( fd, data.data() + done, data.size() - done );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            break; // nowhere left to complain to
+        }
+        done += n;
+    }
+    data.clear();
+}
+
+void Format( const Slot& slot, std::string& out )
+{
+    // the date only changes once a second
+    static time_t lastSecond = -1;
+    static char   date[ 32 ];
+    if( slot.time.tv_sec != lastSecond )
+    {
+        tm local;
+        ::localtime_r( &slot.time.tv_sec, &local );
+        ::strftime( date, sizeof( date ), "%Y-%m-%d %H:%M:%S", &local );
+        lastSecond = slot.time.tv_sec;
+    }
+
+    char prefix[ 64 ];
+    int len = std::snprintf( prefix, sizeof( prefix ), "%s.%03ld %s ",
+                             date, slot.time.tv_nsec / 1000000,
+                             levelNames[ slot.level ] );
+    out.append( prefix, len );
+
+    // replies and commands may span lines, keep one message per line
+    for( uint32_t i = 0; i < slot.len; ++i )
+    {
+        switch( slot.text[ i ] )
+        {
+        case '\r':
+            out += "<CR>";
+            break;
+        case '\n':
+            out += "<LF>";
+            break;
+        default:
+            out += slot.text[ i ];
+        }
+    }
+    out += '\n';
+}
+
+void Drain()
+{
+    static std::string out;
+    static std::string err;
+
+    auto& ring = GetRing();
+    for( ;; )
+    {
+        auto& slot = ring.slots[ ring.readPos & ( ringSize - 1 ) ];
+        if( slot.seq.load( std::memory_order_acquire ) != ring.readPos + 1 )
+        {
+            break;
+        }
+
+        Format( slot, slot.level >= Warn ? err : out );
+        slot.seq.store( ring.readPos + ringSize, std::memory_order_release );
+        ++ring.readPos;
+    }
+
+    if( auto dropped = ring.dropped.exchange( 0, std::memory_order_relaxed ) )
+    {
+        err += "log buffer full, dropped " + std::to_string( dropped ) +
+               " message(s)\n";
+    }
+
+    WriteAll( STDOUT_FILENO, out );
+    WriteAll( STDERR_FILENO, err );
+}
+
+void Run()
+{
+    std::unique_lock< std::mutex > lock { mutex };
+    while( ! stopping )
+    {
+        lock.unlock();
+        Drain();
+        lock.lock();
+        // producers never signal, polling keeps them lock-free
+        cond.wait_for( lock, std::chrono::milliseconds( 10 ) );
+    }
+    lock.unlock();
+    Drain();
+}
+} // namespace
+
+bool RateLimit::Allow( uint32_t& suppressed )
+{
+    timespec now;
+    ::clock_gettime( CLOCK_MONOTONIC_COARSE, &now );
+
+    auto second = second_.load( std::memory_order_relaxed );
+    if( now.tv_sec != second &&
+        second_.compare_exchange_strong( second, now.tv_sec,
+                                         std::memory_order_relaxed ) )
+    {
+        count_.store( 0, std::memory_order_relaxed );
+    }
+
+    if( count_.fetch_add( 1, std::memory_order_relaxed ) < perSecond )
+    {
+        suppressed = suppressed_.exchange( 0, std::memory_order_relaxed );
+        return true;
+    }
+
+    suppressed_.fetch_add( 1, std::memory_order_relaxed );
+    return false;
+}
+
+void Write( Level level, RateLimit& limit, const char* fmt, ... )
+{
+    uint32_t suppressed = 0;
+    if( ! limit.Allow( suppressed ) )
+    {
+        return;
+    }
+
+    auto& ring = GetRing();
+    auto pos = ring.writePos.load( std::memory_order_relaxed );
+    Slot* slot;
+    for( ;; )
+    {
+        slot = &ring.slots[ pos & ( ringSize - 1 ) ];
+        auto seq  = slot->seq.load( std::memory_order_acquire );
+        auto diff = (intptr_t)seq - (intptr_t)pos;
+        if( 0 == diff )
+        {
+            if( ring.writePos.compare_exchange_weak(
+                                    pos, pos + 1,
+                                    std::memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        else if( diff < 0 )
+        {
+            ring.dropped.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        else
+        {
+            pos = ring.writePos.load( std::memory_order_relaxed );
+        }
+    }
+
+    slot->level = level;
+    ::clock_gettime( CLOCK_REALTIME_COARSE, &slot->time );
+
+    va_list args;
+    va_start( args, fmt );
+    int len = std::vsnprintf( slot->text, textSize, fmt, args );
+    va_end( args );
+    len = len < 0 ? 0 : std::min< int >( len, textSize - 1 );
+
+    if( suppressed )
+    {
+        int more = std::snprintf( slot->text + len, textSize - len,
+                                  " (%u similar suppressed)", suppressed );
+        len = std::min< int >( len + std::max( more, 0 ), textSize - 1 );
+    }
+
+    slot->len = len;
+    slot->seq.store( pos + 1, std::memory_order_release );
+}
+
+Flusher::Flusher()
+{
+    stopping = false;
+    thread   = std::thread { Run };
+}
+
+Flusher::~Flusher()
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex };
+        stopping = true;
+    }
+    cond.notify_one();
+    thread.join();
+}
+
+} // namespace log
+} // namespace ttf
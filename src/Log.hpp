@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Levels below this one are compiled out: 0 debug, 1 info, 2 warn, 3 error.
+// Build with -DFCPP_LOG_LEVEL=0 to get the per command and reply tracing.
+#ifndef FCPP_LOG_LEVEL
+#define FCPP_LOG_LEVEL 1
+#endif
+
+namespace fcpp
+{
+namespace log
+{
+
+enum Level
+{
+    Debug,
+    Info,
+    Warn,
+    Error
+};
+
+// runtime threshold on top of FCPP_LOG_LEVEL (--log-level)
+extern std::atomic< int > threshold;
+
+// Caps one call site at 'perSecond' messages, the rest are counted and
+// reported along with the next message that gets through.
+class RateLimit
+{
+public:
+    static constexpr uint32_t perSecond = 100;
+
+    bool Allow( uint32_t& suppressed );
+
+private:
+    std::atomic< int64_t >  second_ { 0 };
+    std::atomic< uint32_t > count_ { 0 };
+    std::atomic< uint32_t > suppressed_ { 0 };
+};
+
+// Formats the message straight into a slot of a lock-free ring buffer, a
+// background thread does the actual writing. Never blocks: when the ring
+// is full the message is dropped and counted.
+void Write( Level level, RateLimit& limit, const char* fmt, ... )
+                                __attribute__(( format( printf, 3, 4 ) ));
+
+// Runs the thread writing messages out, info and debug to stdout, warnings
+// and errors to stderr. Whatever is left is flushed on destruction. Only
+// one may exist at a time.
+class Flusher
+{
+public:
+    Flusher();
+    ~Flusher();
+
+    Flusher( const Flusher& ) = delete;
+    Flusher& operator=( const Flusher& ) = delete;
+};
+
+inline const char* CStr( const char* str )
+{
+    return str;
+}
+
+inline const char* CStr( const std::string& str )
+{
+    return str.c_str();
+}
+
+} // namespace log
+} // namespace ttf
+
+#define FCPP_LOG( level, ... )                                              \
+    do                                                                      \
+    {                                                                       \
+        if( level >= ::fcpp::log::threshold.load(                           \
+                                        std::memory_order_relaxed ) )       \
+        {                                                                   \
+            static ::fcpp::log::RateLimit fcppLogLimit;                     \
+            ::fcpp::log::Write( level, fcppLogLimit, __VA_ARGS__ );         \
+        }                                                                   \
+    } while( 0 )
+
+#define FCPP_LOG_NOTHING() do {} while( 0 )
+
+#if FCPP_LOG_LEVEL <= 0
+#define LOG_DEBUG( ... ) FCPP_LOG( ::fcpp::log::Debug, __VA_ARGS__ )
+#else
+#define LOG_DEBUG( ... ) FCPP_LOG_NOTHING()
+#endif
+
+#if FCPP_LOG_LEVEL <= 1
+#define LOG_INFO( ... ) FCPP_LOG( ::fcpp::log::Info, __VA_ARGS__ )
+#else
+#define LOG_INFO( ... ) FCPP_LOG_NOTHING()
+#endif
+
+#if FCPP_LOG_LEVEL <= 2
+#define LOG_WARN( ... ) FCPP_LOG( ::fcpp::log::Warn, __VA_ARGS__ )
+#else
+#define LOG_WARN( ... ) FCPP_LOG_NOTHING()
+#endif
+
+#define LOG_ERROR( ... ) FCPP_LOG( ::fcpp::log::Error, __VA_ARGS__ )
@@ -0,0 +1,387 @@
+#include "Metrics.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fcpp
+{
+
+namespace
+{
+// histogram buckets are powers of 4 microseconds, 1us up to ~16.8s, plus
+// one for everything slower
+constexpr size_t buckets = 13;
+
+// ids of Metrics instances, 0 is none
+std::atomic< uint64_t > lastId { 0 };
+
+// written by the owning thread only, read by Render() from anywhere
+struct Counter
+{
+    void Add( uint64_t n )
+    {
+        value.store( value.load( std::memory_order_relaxed ) + n,
+                     std::memory_order_relaxed );
+    }
+
+    uint64_t Get() const
+    {
+        return value.load( std::memory_order_relaxed );
+    }
+
+    std::atomic< uint64_t > value { 0 };
+};
+
+struct Histogram
+{
+    void Record( Metrics::Clock::duration elapsed )
+    {
+        auto ns = (uint64_t)std::chrono::duration_cast<
+                                std::chrono::nanoseconds >( elapsed ).count();
+        uint64_t us = ns / 1000;
+
+        // smallest k with us <= 4^k
+        size_t k = us <= 1 ? 0 : ( 65 - __builtin_clzll( us - 1 ) ) / 2;
+        counts[ k < buckets ? k : buckets ].Add( 1 );
+        sumNs.Add( ns );
+    }
+
+    Counter counts[ buckets + 1 ];
+    Counter sumNs;
+};
+
+struct Totals
+{
+    uint64_t counts[ buckets + 1 ] {};
+    uint64_t sumNs = 0;
+
+    void Add( const Histogram& h )
+    {
+        for( size_t i = 0; i <= buckets; ++i )
+        {
+            counts[ i ] += h.counts[ i ].Get();
+        }
+        sumNs += h.sumNs.Get();
+    }
+
+    uint64_t Count() const
+    {
+        uint64_t n = 0;
+        for( auto c : counts )
+        {
+            n += c;
+        }
+        return n;
+    }
+};
+
+const char* const transferNames[] { "list", "retr", "stor" };
+const char  replyClasses[] { '1', '2', '3', '4', '5' };
+
+void Append( std::string& out, const char* fmt, ... )
+                                __attribute__(( format( printf, 2, 3 ) ));
+
+void Append( std::string& out, const char* fmt, ... )
+{
+    char line[ 256 ];
+    va_list args;
+    va_start( args, fmt );
+    int len = std::vsnprintf( line, sizeof( line ), fmt, args );
+    va_end( args );
+    if( len > 0 )
+    {
+        out.append( line, std::min< size_t >( len, sizeof( line ) - 1 ) );
+    }
+}
+
+void AppendHistogram( std::string& out, const char* name, const char* label,
+                      const char* value, const Totals& totals )
+{
+    uint64_t cumulative = 0;
+    double le = 1e-6;
+    for( size_t i = 0; i < buckets; ++i, le *= 4 )
+    {
+        cumulative += totals.counts[ i ];
+        Append( out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n",
+                name, label, value, le, (unsigned long long)cumulative );
+    }
+    cumulative += totals.counts[ buckets ];
+    Append( out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n",
+            name, label, value, (unsigned long long)cumulative );
+    Append( out, "%s_sum{%s=\"%s\"} %.9f\n",
+            name, label, value, totals.sumNs / 1e9 );
+    Append( out, "%s_count{%s=\"%s\"} %llu\n",
+            name, label, value, (unsigned long long)cumulative );
+}
+} // namespace
+
+struct Metrics::Shard
+{
+    explicit Shard( size_t verbs ) :
+        thread   { std::this_thread::get_id() },
+        commands ( verbs )
+    {
+    }
+
+    const std::thread::id thread; // the only one recording into it
+    std::vector< Histogram > commands;
+    Histogram   transfers[ transferKinds ];
+    Counter     bytesSent;
+    Counter     bytesReceived;
+    Counter     replies[ sizeof( replyClasses ) ];
+    Counter     exceptions;
+    Counter     sessionsTotal;
+    Counter     sessions;   // gauges, may go "negative" in one shard
+    Counter     transfersActive;
+};
+
+thread_local Metrics::Cached Metrics::localShard_ { 0, nullptr };
+
+Metrics::Metrics( std::vector< std::string > verbs ) :
+    id_    { ++lastId },
+    verbs_ ( std::move( verbs ) )
+{
+}
+
+Metrics::~Metrics() = default;
+
+Metrics::Shard& Metrics::Local()
+{
+    if( localShard_.owner != id_ )
+    {
+        // the thread recorded into another instance meanwhile, it might
+        // have a shard here already
+        std::lock_guard< std::mutex > lock { mutex_ };
+        auto self = std::this_thread::get_id();
+        auto it = std::find_if( shards_.begin(), shards_.end(),
+                                [ self ]( const auto& shard ) {
+                                    return shard->thread == self;
+                                } );
+        if( it == shards_.end() )
+        {
+            shards_.emplace_back( new Shard { verbs_.size() + 1 } );
+            it = std::prev( shards_.end() );
+        }
+        localShard_ = Cached { id_, it->get() };
+    }
+    return *localShard_.shard;
+}
+
+void Metrics::Command( size_t verb, Clock::time_point start )
+{
+    auto& shard = Local();
+    shard.commands[ verb < verbs_.size() ? verb : verbs_.size() ].Record(
+                                                    Clock::now() - start );
+}
+
+void Metrics::Transfer( TransferKind kind, Clock::time_point start,
+                        uint64_t bytes )
+{
+    auto& shard = Local();
+    shard.transfers[ kind ].Record( Clock::now() - start );
+    ( kind == Stor ? shard.bytesReceived : shard.bytesSent ).Add( bytes );
+}
+
+void Metrics::Reply( char code )
+{
+    if( code >= '1' && code <= '5' )
+    {
+        Local().replies[ code - '1' ].Add( 1 );
+    }
+}
+
+void Metrics::Exception()
+{
+    Local().exceptions.Add( 1 );
+}
+
+void Metrics::SessionStarted()
+{
+    auto& shard = Local();
+    shard.sessionsTotal.Add( 1 );
+    shard.sessions.Add( 1 );
+}
+
+void Metrics::SessionEnded()
+{
+    Local().sessions.Add( uint64_t( -1 ) );
+}
+
+void Metrics::TransferStarted()
+{
+    Local().transfersActive.Add( 1 );
+}
+
+void Metrics::TransferEnded()
+{
+    Local().transfersActive.Add( uint64_t( -1 ) );
+}
+
+std::string Metrics::Render() const
+{
+    std::vector< Totals > commands ( verbs_.size() + 1 );
+    Totals transfers[ transferKinds ];
+    uint64_t bytesSent = 0, bytesReceived = 0, exceptions = 0;
+    uint64_t sessionsTotal = 0, sessions = 0, transfersActive = 0;
+    uint64_t replies[ sizeof( replyClasses ) ] {};
+
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        for( const auto& shard : shards_ )
+        {
+            for( size_t i = 0; i < commands.size(); ++i )
+            {
+                commands[ i ].Add( shard->commands[ i ] );
+            }
+            for( size_t i = 0; i < transferKinds; ++i )
+            {
+                transfers[ i ].Add( shard->transfers[ i ] );
+            }
+            for( size_t i = 0; i < sizeof( replyClasses ); ++i )
+            {
+                replies[ i ] += shard->replies[ i ].Get();
+            }
+            bytesSent       += shard->bytesSent.Get();
+            bytesReceived   += shard->bytesReceived.Get();
+            exceptions      += shard->exceptions.Get();
+            sessionsTotal   += shard->sessionsTotal.Get();
+            sessions        += shard->sessions.Get();
+            transfersActive += shard->transfersActive.Get();
+        }
+    }
+
+    std::string out;
+    out.reserve( 16 * 1024 );
+
+    out += "# HELP ftp_command_duration_seconds Time spent in command "
+           "handlers, transfers excluded.\n"
+           "# TYPE ftp_command_duration_seconds histogram\n";
+    for( size_t i = 0; i < commands.size(); ++i )
+    {
+        // verbs nobody used would only add noise
+        if( commands[ i ].Count() )
+        {
+            AppendHistogram( out, "ftp_command_duration_seconds", "verb",
+                             i < verbs_.size() ? verbs_[ i ].c_str()
+                                               : "unknown",
+                             commands[ i ] );
+        }
+    }
+
+    out += "# HELP ftp_transfer_duration_seconds Data connection transfer "
+           "time.\n"
+           "# TYPE ftp_transfer_duration_seconds histogram\n";
+    for( size_t i = 0; i < transferKinds; ++i )
+    {
+        AppendHistogram( out, "ftp_transfer_duration_seconds", "kind",
+                         transferNames[ i ], transfers[ i ] );
+    }
+
+    out += "# HELP ftp_replies_total Control connection replies by class.\n"
+           "# TYPE ftp_replies_total counter\n";
+    for( size_t i = 0; i < sizeof( replyClasses ); ++i )
+    {
+        Append( out, "ftp_replies_total{class=\"%cxx\"} %llu\n",
+                replyClasses[ i ], (unsigned long long)replies[ i ] );
+    }
+
+    Append( out, "# HELP ftp_sent_bytes_total Bytes sent on data "
+                 "connections.\n"
+                 "# TYPE ftp_sent_bytes_total counter\n"
+                 "ftp_sent_bytes_total %llu\n",
+            (unsigned long long)bytesSent );
+    Append( out, "# HELP ftp_received_bytes_total Bytes received on data "
+                 "connections.\n"
+                 "# TYPE ftp_received_bytes_total counter\n"
+                 "ftp_received_bytes_total %llu\n",
+            (unsigned long long)bytesReceived );
+    Append( out, "# HELP ftp_command_exceptions_total Commands that failed "
+                 "with an exception.\n"
+                 "# TYPE ftp_command_exceptions_total counter\n"
+                 "ftp_command_exceptions_total %llu\n",
+            (unsigned long long)exceptions );
+    Append( out, "# HELP ftp_sessions_total Control connections accepted.\n"
+                 "# TYPE ftp_sessions_total counter\n"
+                 "ftp_sessions_total %llu\n",
+            (unsigned long long)sessionsTotal );
+    Append( out, "# HELP ftp_sessions_active Open control connections.\n"
+                 "# TYPE ftp_sessions_active gauge\n"
+                 "ftp_sessions_active %lld\n",
+            (long long)sessions );
+    Append( out, "# HELP ftp_transfers_active Running data transfers.\n"
+                 "# TYPE ftp_transfers_active gauge\n"
+                 "ftp_transfers_active %lld\n",
+            (long long)transfersActive );
+
+    return out;
+}
+
+MetricsFile::MetricsFile( boost::asio::io_service& io_service,
+                          const Metrics& metrics, std::string path,
+                          size_t interval ) :
+    metrics_  ( metrics ),
+    path_     ( std::move( path ) ),
+    interval_ ( interval ? interval : 1 ),
+    timer_    { io_service }
+{
+    Write();
+    Schedule();
+}
+
+void MetricsFile::Schedule()
+{
+    timer_.expires_from_now( interval_ );
+    timer_.async_wait( [ this ]( const boost::system::error_code& error ) {
+        if( ! error )
+        {
+            Write();
+            Schedule();
+        }
+    } );
+}
+
+void MetricsFile::Write()
+{
+    auto text = metrics_.Render();
+    auto tmp  = path_ + ".tmp";
+
+    int fd = ::open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     0644 );
+    if( -1 == fd )
+    {
+        PRINT_ERR_STR( "failed to write metrics to '" + tmp + "': " +
+                       ::strerror( errno ) );
+        return;
+    }
+
+    size_t done = 0;
+    while( done < text.size() )
+    {
+        auto n = ::write( fd, text.data() + done, text.size() - done );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            break;
+        }
+        done += n;
+    }
+    ::close( fd );
+
+    if( done != text.size() || -1 == ::rename( tmp.c_str(), path_.c_str() ) )
+    {
+        PRINT_ERR_STR( "failed to write metrics to '" + path_ + "': " +
+                       ::strerror( errno ) );
+        ::unlink( tmp.c_str() );
+    }
+}
+
+} // namespace ttf
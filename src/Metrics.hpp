@@ -0,0 +1,103 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fcpp
+{
+
+// Server counters and latency histograms. Every thread records into its
+// own shard, so recording is a few plain stores without any shared cache
+// line; Render() sums the shards up. There is usually one instance per
+// process (it lives in Context), a thread keeps a shard in each instance it
+// records into.
+class Metrics
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum TransferKind
+    {
+        List, // LIST, NLST and MLSD
+        Retr,
+        Stor, // STOR and APPE
+        transferKinds
+    };
+
+    // 'verbs' names the command indices passed to Command(), one more index
+    // (verbs.size()) counts unknown commands
+    explicit Metrics( std::vector< std::string > verbs );
+    ~Metrics();
+
+    Metrics( const Metrics& ) = delete;
+    Metrics& operator=( const Metrics& ) = delete;
+
+    // time spent in a command handler, transfers are accounted separately
+    void Command( size_t verb, Clock::time_point start );
+
+    // a finished transfer, 'bytes' went out for List/Retr and came in for
+    // Stor
+    void Transfer( TransferKind kind, Clock::time_point start,
+                   uint64_t bytes );
+
+    // a reply sent on a control connection, by its first digit
+    void Reply( char code );
+
+    // a command that failed with an exception
+    void Exception();
+
+    void SessionStarted();
+    void SessionEnded();
+    void TransferStarted();
+    void TransferEnded();
+
+    // everything in the Prometheus text exposition format
+    std::string Render() const;
+
+private:
+    struct Shard;
+
+    Shard& Local();
+
+    // the shard a thread recorded into last and the id of its instance
+    struct Cached
+    {
+        uint64_t    owner;
+        Shard*      shard;
+    };
+
+    static thread_local Cached localShard_;
+
+    const uint64_t                          id_; // never reused, unlike this
+    const std::vector< std::string >        verbs_;
+    mutable std::mutex                      mutex_;
+    std::vector< std::unique_ptr< Shard > > shards_;
+};
+
+// Rewrites 'path' with Metrics::Render() every 'interval' seconds. It goes
+// through a temporary file and rename(2), so a reader (e.g. the
+// node_exporter textfile collector) never sees a partial file.
+class MetricsFile
+{
+public:
+    MetricsFile( boost::asio::io_service& io_service, const Metrics& metrics,
+                 std::string path, size_t interval );
+
+private:
+    void Schedule();
+    void Write();
+
+    const Metrics&              metrics_;
+    const std::string           path_;
+    const std::chrono::seconds  interval_;
+    boost::asio::steady_timer   timer_;
+};
+
+} // namespace ttf
@@ -0,0 +1,143 @@
+#include "PortPool.hpp"
+#include "Utils.hpp"
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+
+namespace fcpp
+{
+
+PortPool::PortPool( int family, uint16_t first, uint16_t last,
+                    size_t prebound ) :
+    family_   { family },
+    prebound_ { prebound }
+{
+    for( uint32_t port = first; port <= last; ++port )
+    {
+        free_.push_back( (uint16_t)port );
+    }
+    bound_.reserve( prebound_ );
+    Refill();
+}
+
+FileDescriptor PortPool::Listen( uint16_t port ) const
+{
+    FileDescriptor fd {
+        ::socket( family_, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )
+    };
+
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons( port );
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+
+    sockaddr_in6 addr6 {};
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port   = htons( port );
+    addr6.sin6_addr   = in6addr_any;
+
+    const bool v6 = AF_INET6 == family_;
+    int on = 1;
+    if( ! fd ||
+        -1 == ::setsockopt( fd.get(), SOL_SOCKET, SO_REUSEADDR, &on,
+                            sizeof( on ) ) ||
+        -1 == ::bind( fd.get(),
+                      v6 ? (const sockaddr*)&addr6 : (const sockaddr*)&addr,
+                      v6 ? sizeof( addr6 ) : sizeof( addr ) ) ||
+        -1 == ::listen( fd.get(), SOMAXCONN ) )
+    {
+        if( errno != EADDRINUSE )
+        {
+            PRINT_ERR_STR(
+                ( boost::format( "failed to listen on port %d (%s)" )
+                                 % port % ::strerror( errno ) ).str()
+            );
+        }
+        return FileDescriptor {};
+    }
+
+    return fd;
+}
+
+PortPool::Listener PortPool::Acquire()
+{
+    size_t attempts = 0;
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        if( ! bound_.empty() )
+        {
+            Listener listener = std::move( bound_.back() );
+            bound_.pop_back();
+            return listener;
+        }
+        attempts = free_.size();
+    }
+
+    // nothing prebound, bind one now; ports that turn out to be in use go
+    // to the back of the queue
+    for( ; attempts > 0; --attempts )
+    {
+        uint16_t port = 0;
+        {
+            std::lock_guard< std::mutex > lock { mutex_ };
+            if( free_.empty() )
+            {
+                break;
+            }
+            port = free_.front();
+            free_.pop_front();
+        }
+
+        auto fd = Listen( port );
+        if( fd )
+        {
+            return Listener { port, std::move( fd ) };
+        }
+
+        std::lock_guard< std::mutex > lock { mutex_ };
+        free_.push_back( port );
+    }
+
+    throw std::runtime_error { "no free passive port" };
+}
+
+void PortPool::Release( uint16_t port )
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        free_.push_back( port );
+    }
+    Refill();
+}
+
+void PortPool::Refill()
+{
+    for( ;; )
+    {
+        uint16_t port = 0;
+        {
+            std::lock_guard< std::mutex > lock { mutex_ };
+            if( bound_.size() >= prebound_ || free_.empty() )
+            {
+                return;
+            }
+            port = free_.front();
+            free_.pop_front();
+        }
+
+        auto fd = Listen( port );
+
+        std::lock_guard< std::mutex > lock { mutex_ };
+        if( ! fd )
+        {
+            free_.push_back( port ); // in use elsewhere, try it later
+            return;
+        }
+        bound_.push_back( Listener { port, std::move( fd ) } );
+    }
+}
+
+} // namespace ttf
@@ -0,0 +1,63 @@
+#pragma once
+#include "FileDescriptor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace fcpp
+{
+
+// The ports PASV/EPSV listen on. Hands out free ports of a configured range
+// in O(1), least recently used first, and keeps a few sockets bound and
+// listening ahead of time so a PASV usually costs no syscalls at all. Ports
+// another process holds are skipped, so PASV never fails with EADDRINUSE
+// while the range has a free port. Listeners are of the family the control
+// connections are, IPv6 ones take IPv4 clients too unless the system sets
+// IPV6_V6ONLY. Thread-safe.
+class PortPool
+{
+public:
+    struct Listener
+    {
+        uint16_t        port;
+        FileDescriptor  fd; // listening, non-blocking
+    };
+
+    // the ports 'first'..'last' of address family 'family' (AF_INET or
+    // AF_INET6), 'prebound' of them listening in advance
+    PortPool( int family, uint16_t first, uint16_t last, size_t prebound );
+
+    PortPool( const PortPool& ) = delete;
+    PortPool& operator=( const PortPool& ) = delete;
+
+    int family() const
+    {
+        return family_;
+    }
+
+    // Takes a free port and a socket listening on it, throws
+    // std::runtime_error if none can be had.
+    Listener Acquire();
+
+    // gives back the port of an Acquire()d listener once it is closed
+    void Release( uint16_t port );
+
+private:
+    // bound and listening socket on 'port', an invalid descriptor if the
+    // port is taken by someone else
+    FileDescriptor Listen( uint16_t port ) const;
+
+    // binds listeners until 'prebound_' of them are ready
+    void Refill();
+
+    const int                   family_;
+    const size_t                prebound_;
+
+    std::mutex                  mutex_;
+    std::deque< uint16_t >      free_;  // neither leased nor listening
+    std::vector< Listener >     bound_; // listening, ready to hand out
+};
+
+} // namespace ttf
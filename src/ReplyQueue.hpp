@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fcpp
+{
+
+// Outbound replies of one control connection. Replies come from the
+// connection's own io_service thread as well as from the transfer threads,
+// so any thread may Push() (a lock-free stack); only the io_service thread
+// takes them out again, all at once and in the order they were pushed.
+class ReplyQueue
+{
+public:
+    ReplyQueue() :
+        head_ { nullptr }
+    {
+    }
+
+    ~ReplyQueue()
+    {
+        std::vector< std::string > dropped;
+        TakeAll( dropped );
+    }
+
+    ReplyQueue( const ReplyQueue& ) = delete;
+    ReplyQueue& operator=( const ReplyQueue& ) = delete;
+
+    // Returns true if the queue was empty, the caller then has to get the
+    // consumer going. 'close' marks the last reply of the connection.
+    bool Push( std::string text, bool close )
+    {
+        auto reply = new Reply { std::move( text ), close,
+                                 head_.load( std::memory_order_relaxed ) };
+        while( ! head_.compare_exchange_weak( reply->next, reply,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed ) )
+        {
+        }
+        return reply->next == nullptr;
+    }
+
+    // Consumer only. Appends every pending reply to 'out', oldest first,
+    // and returns true if one of them was the closing one.
+    bool TakeAll( std::vector< std::string >& out )
+    {
+        // the stack is newest first, reverse it
+        Reply* fifo = nullptr;
+        for( Reply* stack = head_.exchange( nullptr,
+                                            std::memory_order_acquire );
+             stack; )
+        {
+            auto next   = stack->next;
+            stack->next = fifo;
+            fifo        = stack;
+            stack       = next;
+        }
+
+        bool close = false;
+        while( fifo )
+        {
+            auto next = fifo->next;
+            close = close || fifo->close;
+            out.push_back( std::move( fifo->text ) );
+            delete fifo;
+            fifo = next;
+        }
+        return close;
+    }
+
+private:
+    struct Reply
+    {
+        std::string text;
+        bool        close;
+        Reply*      next;
+    };
+
+    std::atomic< Reply* > head_;
+};
+
+} // namespace ttf
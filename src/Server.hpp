@@ -1,7 +1,12 @@
 #pragma once
+#include "Command.hpp"
+#include "Context.hpp"
 #include "Enums.hpp"
 #include "Ftp.hpp"
+#include "IoServicePool.hpp"
+#include "ReplyQueue.hpp"
 #include "Session.hpp"
+#include "TimerWheel.hpp"
 #include "Utils.hpp"
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
@@ -10,27 +15,18 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/format.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <chrono>
 #include <cstdint>
-#include <iostream>
-#include <mutex>
+#include <memory>
 #include <string>
+#include <vector>
 
 using boost::asio::ip::tcp;
 
 namespace fcpp
 {
 
-namespace
-{
-void PrintCommand( std::string cmd )
-{
-    StringRepl( cmd, "\r", "<CR>" );
-    StringRepl( cmd, "\n", "<LF>" );
-
-    std::cout << cmd << "\n";
-}
-}
-
 class TcpConnection : public boost::enable_shared_from_this< TcpConnection >
 {
 public:
@@ -41,12 +37,13 @@ public:
 
     ~TcpConnection()
     {
-        std::cout << "~TcpConnection \n";
+        LOG_DEBUG( "~TcpConnection" );
     }
 
-    static pointer create( boost::asio::io_service& io_service )
+    static pointer create( boost::asio::io_service& io_service,
+                           Context& context )
     {
-        return pointer( new TcpConnection { io_service } );
+        return pointer( new TcpConnection { io_service, context } );
     }
 
     pointer get()
@@ -64,62 +61,164 @@ public:
         return socket_.get_io_service();
     }
 
+    // the timer wheel of the connection's io_service
+    TimerWheel& wheel()
+    {
+        return wheel_;
+    }
+
+    // io_service thread: the session counts as busy, not idle, until the
+    // returned token is gone; it may be dropped on any thread
+    std::shared_ptr< void > Busy()
+    {
+        ++busy_;
+        auto self = shared_from_this();
+        return std::shared_ptr< void >( nullptr, [ self ]( void* ) {
+            self->io_service().post( [ self ]() {
+                --self->busy_;
+                self->Touch();
+            } );
+        } );
+    }
+
+    // Runs on the connection's io_service. Greets the client, or refuses it
+    // with 421 and closes the connection when admission control turns the
+    // session away.
     void start()
     {
-        boost::asio::async_write(
-                socket_,
-                boost::asio::buffer( "220 welcome\r\n" ),
-                boost::bind( &TcpConnection::HandleWrite, shared_from_this(),
-                             boost::asio::placeholders::error )
-        );
+        boost::system::error_code error;
+        auto peer = socket_.remote_endpoint( error );
+        if( error )
+        {
+            return; // already gone
+        }
+
+        auto refusal = session_.context.admission.AdmitSession(
+                                peer.address(), sizeof( *this ),
+                                session_.admission );
+        if( ! refusal.empty() )
+        {
+            LOG_WARN( "refusing %s: %s", peer.address().to_string().c_str(),
+                      refusal.c_str() );
+            SendReply< ReplyType::Close >( refusal );
+            return;
+        }
+
+        session_.started = true;
+        session_.context.metrics.SessionStarted();
+        SendReply( "220 welcome" );
+        StartRead();
+
+        if( session_.context.config.idleTimeout )
+        {
+            Touch();
+            WatchIdle( std::chrono::seconds(
+                                session_.context.config.idleTimeout ) );
+        }
     }
 
-    template < ReplyType type = ReplyType::WaitResponse >
+    // Safe to call from any thread. Replies are queued and written by the
+    // connection's io_service in order, whatever is pending by then goes
+    // out in one gathered write. ReplyType::Close is for the io_service
+    // thread only (QUIT).
+    template < ReplyType type = ReplyType::Normal >
     void SendReply( std::string reply )
     {
-        std::lock_guard< std::mutex > { mutex_ };
-
+        LOG_DEBUG( "  --> %s", reply.c_str() );
+        session_.context.metrics.Reply( reply[ 0 ] );
         reply += "\r\n";
-        PrintCommand( "  --> " + reply );
 
-        if( ReplyType::WaitResponse == type )
+        if( ReplyType::Close == type )
         {
-            boost::asio::async_write(
-                socket_,
-                boost::asio::buffer( reply ),
-                boost::bind( &TcpConnection::HandleWrite, shared_from_this(),
-                             boost::asio::placeholders::error )
-            );
+            closing_ = true;
         }
-        else
+
+        if( replies_.Push( std::move( reply ), ReplyType::Close == type ) )
         {
-            boost::asio::async_write(
-                socket_,
-                boost::asio::buffer( reply ),
-                boost::bind( &TcpConnection::HandleWriteAndExit,
-                             shared_from_this(),
-                             boost::asio::placeholders::error )
-            );
+            io_service().post( boost::bind( &TcpConnection::Flush,
+                                            shared_from_this() ) );
         }
     }
 
 private:
-    TcpConnection( boost::asio::io_service& io_service ) :
+    TcpConnection( boost::asio::io_service& io_service, Context& context ) :
         socket_ { io_service },
-        session_ { *this }
+        session_ { *this, context },
+        wheel_ ( boost::asio::use_service< TimerWheel >( io_service ) )
+    {
+    }
+
+    void Touch()
+    {
+        lastActivity_ = TimerWheel::Clock::now();
+    }
+
+    void WatchIdle( TimerWheel::Clock::duration delay )
+    {
+        boost::weak_ptr< TcpConnection > weak = shared_from_this();
+        wheel_.Schedule( delay, [ weak ]() {
+            if( auto self = weak.lock() )
+            {
+                self->CheckIdle();
+            }
+        } );
+    }
+
+    // closes the session once it saw neither commands nor transfers for the
+    // idle timeout, or checks again when that will be the case
+    void CheckIdle()
+    {
+        if( closing_ || ! socket_.is_open() )
+        {
+            return;
+        }
+        if( busy_ )
+        {
+            Touch();
+        }
+
+        auto timeout = std::chrono::seconds(
+                                session_.context.config.idleTimeout );
+        auto idle = TimerWheel::Clock::now() - lastActivity_;
+        if( idle < timeout )
+        {
+            WatchIdle( timeout - idle );
+            return;
+        }
+
+        LOG_INFO( "closing idle session" );
+        SendReply< ReplyType::Close >(
+                        "421 idle timeout, closing control connection" );
+    }
+
+    // Reads are independent of replies: whatever arrives is split into
+    // lines and every complete command is run before the next read, so a
+    // client may pipeline commands without waiting for each reply.
+    void StartRead()
     {
+        socket_.async_read_some(
+            reader_.Prepare(),
+            boost::bind( &TcpConnection::HandleRead, shared_from_this(),
+                         boost::asio::placeholders::error,
+                         boost::asio::placeholders::bytes_transferred )
+        );
     }
 
-    void HandleRead( const boost::system::error_code& error )
+    void HandleRead( const boost::system::error_code& error,
+                     size_t bytes )
     {
         if( error && boost::asio::error::eof == error )
         {
-            std::cout << "client disconnected" << "\n";
+            LOG_INFO( "client disconnected" );
             return;
         }
+        else if( error && boost::asio::error::operation_aborted == error )
+        {
+            return; // closed by us, e.g. idle timeout
+        }
         else if( error && boost::asio::error::broken_pipe == error )
         {
-            std::cout << "connection was interrupted" << "\n";
+            LOG_INFO( "connection was interrupted" );
             return;
         }
         else if( error )
@@ -130,29 +229,51 @@ private:
             return;
         }
 
-        try
+        reader_.Commit( bytes );
+        Touch();
+
+        Command cmd;
+        while( ! closing_ )
         {
-            auto data = buff_.data();
-            std::string cmdstring(
-                    boost::asio::buffers_begin(data),
-                    boost::asio::buffers_end(data)
-            );
-            buff_.consume( buff_.size() );
+            auto status = reader_.Next( cmd );
+            if( status == CommandReader::Status::NeedMore )
+            {
+                StartRead();
+                return;
+            }
+
+            if( status == CommandReader::Status::TooLong )
+            {
+                SendReply( "500 command line too long" );
+                continue;
+            }
+
+            Execute( cmd );
+        }
+    }
 
-            PrintCommand( "new cmd: '" + cmdstring + "'" );
+    void Execute( const Command& cmd )
+    {
+        try
+        {
+            LOG_DEBUG( "new cmd: '%.*s%s%.*s'",
+                       (int)cmd.command.size(), cmd.command.data(),
+                       cmd.arg.empty() ? "" : " ",
+                       (int)cmd.arg.size(), cmd.arg.data() );
 
-            ftp::ProcessCommand( Command { cmdstring }, session_ );
+            ftp::ProcessCommand( cmd, session_ );
 
             return;
         }
         catch( std::exception& ex )
         {
             PRINT_EX( ex );
+            session_.context.metrics.Exception();
         }
 
         try
         {
-            SendReply( "500 error processing last command\r\n" );
+            SendReply( "500 error processing last command" );
         }
         catch ( std::exception& ex )
         {
@@ -161,25 +282,40 @@ private:
         }
     }
 
-    void HandleWrite( const boost::system::error_code& error )
+    void Flush()
     {
-        if( error )
+        // the completion of the write in flight flushes again
+        if( writing_ || ! socket_.is_open() )
         {
-            PRINT_ERR_STR(
-                ( boost::format( "%s" ) % error.message() ).str()
-            );
             return;
         }
 
-        boost::asio::async_read_until(
-            socket_, buff_, std::string { "\r\n" },
-            boost::bind( &TcpConnection::HandleRead, shared_from_this(),
-                         boost::asio::placeholders::error )
+        bool close = replies_.TakeAll( sending_ );
+        if( sending_.empty() )
+        {
+            return;
+        }
+
+        buffers_.clear();
+        for( const auto& reply : sending_ )
+        {
+            buffers_.push_back( boost::asio::buffer( reply ) );
+        }
+
+        writing_ = true;
+        boost::asio::async_write(
+            socket_,
+            buffers_,
+            boost::bind( &TcpConnection::HandleWrite, shared_from_this(),
+                         boost::asio::placeholders::error, close )
         );
     }
 
-    void HandleWriteAndExit( const boost::system::error_code& error )
+    void HandleWrite( const boost::system::error_code& error, bool close )
     {
+        writing_ = false;
+        sending_.clear();
+
         if( error )
         {
             PRINT_ERR_STR(
@@ -187,25 +323,62 @@ private:
             );
             return;
         }
+
+        if( close )
+        {
+            boost::system::error_code ignored;
+            socket_.shutdown( tcp::socket::shutdown_both, ignored );
+            socket_.close( ignored );
+            return;
+        }
+
+        Flush();
     }
 
-    boost::asio::streambuf buff_;
+    CommandReader   reader_;
     tcp::socket     socket_;
     Session         session_;
-    std::mutex      mutex_;
+    bool            closing_ = false; // QUIT, ignore further commands
+    TimerWheel&     wheel_;
+    TimerWheel::Clock::time_point lastActivity_; // last command or transfer
+    size_t          busy_ = 0; // live Busy() tokens
+
+    ReplyQueue                                  replies_;
+    bool                                        writing_ = false;
+    std::vector< std::string >                  sending_; // in flight
+    std::vector< boost::asio::const_buffer >    buffers_;
 };
 
 class TcpServer
 {
 public:
-    TcpServer( boost::asio::io_service& io_service, std::string address,
-               uint16_t port ) :
-        acceptor_ {
-            io_service,
-            tcp::endpoint(
-                boost::asio::ip::address::from_string( address ), port )
-        }
+    // Listens on 'acceptorService'. New connections are spread over the
+    // whole pool, or stay on the acceptor's own io_service when the server
+    // is one of several SO_REUSEPORT acceptors (one per reactor thread).
+    TcpServer( Context& context, IoServicePool& pool,
+               boost::asio::io_service& acceptorService ) :
+        context_   ( context ),
+        pool_      ( pool ),
+        acceptor_  { acceptorService },
+        reusePort_ { context.config.reusePort }
     {
+        typedef boost::asio::detail::socket_option::boolean<
+                                SOL_SOCKET, SO_REUSEPORT > reuse_port;
+
+        tcp::endpoint endpoint {
+            boost::asio::ip::address::from_string( context.config.address ),
+            context.config.port
+        };
+
+        acceptor_.open( endpoint.protocol() );
+        acceptor_.set_option( tcp::acceptor::reuse_address( true ) );
+        if( reusePort_ )
+        {
+            acceptor_.set_option( reuse_port( true ) );
+        }
+        acceptor_.bind( endpoint );
+        acceptor_.listen();
+
         StartAccept();
     }
 
@@ -213,7 +386,10 @@ private:
     void StartAccept()
     {
         TcpConnection::pointer conn =
-                TcpConnection::create( acceptor_.get_io_service() );
+                TcpConnection::create( reusePort_ ?
+                                       acceptor_.get_io_service() :
+                                       pool_.next(),
+                                       context_ );
 
         acceptor_.async_accept(
                 conn->socket(),
@@ -231,13 +407,17 @@ private:
     {
         if ( !error )
         {
-            conn->start();
+            conn->io_service().dispatch(
+                        boost::bind( &TcpConnection::start, conn ) );
         }
 
         StartAccept();
     }
 
-    tcp::acceptor acceptor_;
+    Context&        context_;
+    IoServicePool&  pool_;
+    tcp::acceptor   acceptor_;
+    bool            reusePort_;
 };
 
 } // namespace ttf
@@ -1,3 +1,6 @@
+#include "Context.hpp"
+#include "Deflate.hpp"
+#include "Directory.hpp"
 #include "Enums.hpp"
 #include "Server.hpp"
 #include "Utils.hpp"
@@ -5,50 +8,174 @@
 #include <arpa/inet.h>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/format.hpp>
-#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
 #include <memory>
 #include <netinet/in.h>
 #include <string>
 #include <sys/socket.h>
+#include <unistd.h>
 
 using boost::asio::ip::tcp;
 
 namespace fcpp
 {
-Session::Session( TcpConnection& conn ) :
+
+namespace
+{
+// absolute path of an open directory, as the kernel sees it
+std::string PathOf( int fd )
+{
+    char path[ PATH_MAX + 1 ];
+    auto link = ( boost::format( "/proc/self/fd/%d" ) % fd ).str();
+    auto len = ::readlink( link.c_str(), path, PATH_MAX );
+    if( -1 == len )
+    {
+        throw std::runtime_error {
+            ( boost::format( "readlink failed (%s)" )
+                             % ::strerror( errno ) ).str()
+        };
+    }
+
+    return std::string( path, len );
+}
+// Accepts the data connection of 'client'. Connections from anyone else,
+// e.g. queued on a prebound listener before PASV handed it out, are
+// dropped so no one can steal the transfer.
+void Accept( TcpConnection::pointer conn, Session::AcceptorPtr acceptor,
+             boost::asio::ip::address client,
+             Session::AcceptHandler handler )
+{
+    auto socket = std::make_shared< tcp::socket >( conn->io_service() );
+    acceptor->async_accept( *socket,
+        [ conn, acceptor, socket, client, handler ](
+                                    const boost::system::error_code& error )
+    {
+        if( error )
+        {
+            acceptor->close();
+            PRINT_ERR_STR( "passive data connection failed: " +
+                           error.message() );
+            conn->SendReply( "425 can't open data connection" );
+            return;
+        }
+
+        boost::system::error_code ignored;
+        auto peer = socket->remote_endpoint( ignored ).address();
+        if( peer != client )
+        {
+            LOG_WARN( "dropped data connection from %s",
+                      peer.to_string().c_str() );
+            socket->close( ignored );
+            Accept( conn, acceptor, client, handler );
+            return;
+        }
+
+        acceptor->close();
+        handler( std::move( *socket ) );
+    } );
+}
+} // namespace
+
+Session::Session( TcpConnection& conn, Context& ctx ) :
+    started       {},
     authenticated {},
     mode          { ConnectionMode::Normal },
-    connection    { conn }
+    cwd           { ctx.config.root },
+    cwdFd         {
+        ::open( ctx.config.root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC )
+    },
+    mlstFacts     { mlst::Default },
+    restartOffset { -1 },
+    allocSize     {},
+    modeZ         {},
+    epsvAll       {},
+    deflateLevel  { deflate::defaultLevel },
+    hashAlgorithm { checksum::Algorithm::Sha256 },
+    connection    { conn },
+    context       ( ctx ),
+    transfers     {
+        std::make_shared< TransferExecutor::Group >(
+                                        ctx.config.sessionTransfers )
+    },
+    rateLimit     {
+        std::make_shared< Shaper::Bucket >( ctx.config.sessionRate )
+    }
 {
 }
 
-tcp::socket Session::AcceptPassiveConn()
+void Session::AcceptPassiveConn( AcceptHandler handler )
 {
-    assert( pasvPtr );
+    mode = ConnectionMode::Normal;
+    if( ! pasvPtr )
+    {
+        connection.SendReply( "425 use PASV first" );
+        return;
+    }
+
+    boost::system::error_code error;
+    auto client = connection.socket().remote_endpoint( error ).address();
+    Accept( connection.get(), std::move( pasvPtr ), client,
+            std::move( handler ) );
+}
 
-    tcp::socket socket( connection.io_service() );
-    pasvPtr->accept( socket );
+void Session::ClosePassiveConn()
+{
     pasvPtr.reset();
-    return socket;
+    mode = ConnectionMode::Normal;
 }
 
-Session::~Session()
+void Session::ChangeDir( const char* dir )
 {
-    try
+    FileDescriptor fd {
+        ::openat( cwdFd.get(), dir, O_PATH | O_DIRECTORY | O_CLOEXEC )
+    };
+    if( ! fd )
     {
-        std::cout << "~Session\n";
+        throw std::runtime_error {
+            ( boost::format( "failed to open directory '%s' (%s)" )
+                             % dir % ::strerror( errno ) ).str()
+        };
+    }
 
-        std::for_each( workers.begin(), workers.end(),
-                []( std::thread& worker ) {
-                        worker.join();
-                }
-        );
+    cwd   = PathOf( fd.get() );
+    cwdFd = std::move( fd );
+}
 
-        std::cout << "worker threads cleanup complete \n";
+void Session::PostTransfer( TransferExecutor::Job job, size_t memory )
+{
+    // such a job would never start, see Config::Parse
+    if( ! context.admission.Fits( memory ) )
+    {
+        connection.SendReply( "425 transfer needs more memory than the "
+                              "server has" );
+        return;
     }
-    catch ( std::exception& ex )
+
+    auto conn = connection.get();
+    auto expired = [ conn ]() {
+        conn->SendReply( "425 server is out of memory, try again later" );
+    };
+    if( ! context.transfers.Post( transfers, std::move( job ), memory,
+                                  expired ) )
+    {
+        connection.SendReply( "425 too many transfers, try again later" );
+    }
+}
+
+std::vector< Shaper::BucketPtr > Session::RateLimits() const
+{
+    return { rateLimit, context.shaper.User( user ), context.shaper.Global() };
+}
+
+Session::~Session()
+{
+    LOG_DEBUG( "~Session" );
+    if( started )
     {
-        PRINT_EX( ex );
+        context.metrics.SessionEnded();
     }
 }
 } //namespace ttf
@@ -1,15 +1,21 @@
 #pragma once
+#include "Admission.hpp"
+#include "Checksum.hpp"
 #include "Enums.hpp"
+#include "FileDescriptor.hpp"
+#include "Shaper.hpp"
+#include "TransferExecutor.hpp"
 #include "Utils.hpp"
 #include <arpa/inet.h>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/format.hpp>
 #include <cassert>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <netinet/in.h>
 #include <string>
 #include <sys/socket.h>
-#include <thread>
 #include <vector>
 
 using boost::asio::ip::tcp;
@@ -18,23 +24,58 @@ namespace fcpp
 {
 
 class TcpConnection;
+struct Context;
 
 struct Session
 {
-    typedef std::unique_ptr< tcp::acceptor > AcceptorPtr;
+    typedef std::shared_ptr< tcp::acceptor > AcceptorPtr;
+    typedef std::function< void( tcp::socket ) > AcceptHandler;
 
     Session() = delete;
-    Session( TcpConnection& conn );
+    Session( TcpConnection& conn, Context& ctx );
     ~Session();
 
-    tcp::socket AcceptPassiveConn();
+    // Waits asynchronously for the client to open the passive data
+    // connection and calls 'handler' with it on the session's io_service.
+    // If nobody connects before the PASV deadline closes the acceptor the
+    // client gets 425 and 'handler' is never called.
+    void AcceptPassiveConn( AcceptHandler handler );
 
+    // drops a PASV acceptor nobody is going to use
+    void ClosePassiveConn();
+
+    // changes the session's working directory, throws on failure
+    void ChangeDir( const char* dir );
+
+    // runs a data transfer holding up to 'memory' bytes of buffers on the
+    // shared transfer threads, replies 425 if the server is too busy to
+    // queue it
+    void PostTransfer( TransferExecutor::Job job, size_t memory );
+
+    // the token buckets a transfer of this session draws from: its own,
+    // the user's and the global one
+    std::vector< Shaper::BucketPtr > RateLimits() const;
+
+    bool                started; // admitted and counted in the metrics
     bool                authenticated;
     ConnectionMode      mode;
     std::string         user;
+    std::string         cwd;   // absolute path reported by PWD
+    FileDescriptor      cwdFd; // cwd opened with O_PATH, base of *at() calls
+    unsigned            mlstFacts; // mlst::Fact set chosen with OPTS MLST
+    int64_t             restartOffset; // set by REST for the next transfer,
+                                       // -1 if there was none
+    uint64_t            allocSize; // set by ALLO for the next upload
+    bool                modeZ; // MODE Z, transfers are deflate compressed
+    bool                epsvAll; // EPSV ALL, PASV is refused from then on
+    int                 deflateLevel; // set with OPTS MODE Z LEVEL
+    checksum::Algorithm hashAlgorithm; // HASH digest, set with OPTS HASH
     TcpConnection&      connection;
+    Context&            context;
     AcceptorPtr         pasvPtr;
-    std::vector< std::thread > workers;
+    TransferExecutor::GroupPtr transfers;
+    Shaper::BucketPtr   rateLimit; // per-session bandwidth, see SITE RATE
+    Admission::Ticket   admission; // session slot, taken when accepted
 };
 
 } //namespace ttf
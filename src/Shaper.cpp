@@ -0,0 +1,145 @@
+#include "Shaper.hpp"
+#include <algorithm>
+
+namespace fcpp
+{
+
+namespace
+{
+// rates are re-read at least this often while waiting, so a SITE RATE
+// change applies to running transfers too
+constexpr auto maxWait = std::chrono::milliseconds( 100 );
+
+// a bucket holds up to a quarter second worth of data
+uint64_t Burst( uint64_t rate )
+{
+    return std::max< uint64_t >( rate / 4, 4 * Shaper::minGrant );
+}
+} // namespace
+
+Shaper::Bucket::Bucket( uint64_t rate ) :
+    rate_   { rate },
+    active_ { 0 },
+    tokens_ ( (double)Burst( rate ) ),
+    last_   ( Clock::now() )
+{
+}
+
+void Shaper::Bucket::SetRate( uint64_t rate )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    Refill( Clock::now() );
+    rate_.store( rate, std::memory_order_relaxed );
+    tokens_ = std::min( tokens_, (double)Burst( rate ) );
+}
+
+void Shaper::Bucket::Refill( Clock::time_point now )
+{
+    std::chrono::duration< double > elapsed = now - last_;
+    last_ = now;
+    tokens_ = std::min( tokens_ + elapsed.count() * Rate(),
+                        (double)Burst( Rate() ) );
+}
+
+size_t Shaper::Bucket::Share() const
+{
+    auto active = std::max< size_t >(
+                            active_.load( std::memory_order_relaxed ), 1 );
+    return std::max< size_t >( Burst( Rate() ) / active, minGrant );
+}
+
+Shaper::Clock::duration Shaper::Bucket::Wait()
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    Refill( Clock::now() );
+    if( tokens_ > 0 || 0 == Rate() )
+    {
+        return Clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast< Clock::duration >(
+                std::chrono::duration< double >( -tokens_ / Rate() ) ) +
+           std::chrono::microseconds( 100 );
+}
+
+void Shaper::Bucket::Take( size_t bytes )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    tokens_ -= bytes;
+}
+
+Shaper::Transfer::Transfer( std::vector< BucketPtr > buckets ) :
+    buckets_ ( std::move( buckets ) ),
+    wait_    ( Clock::duration::zero() )
+{
+    for( const auto& bucket : buckets_ )
+    {
+        ++bucket->active_;
+    }
+}
+
+Shaper::Transfer::~Transfer()
+{
+    for( const auto& bucket : buckets_ )
+    {
+        --bucket->active_;
+    }
+}
+
+size_t Shaper::Transfer::Acquire( size_t want )
+{
+    size_t grant = want;
+    Clock::duration wait = Clock::duration::zero();
+    for( const auto& bucket : buckets_ )
+    {
+        if( bucket->Rate() )
+        {
+            grant = std::min( grant, bucket->Share() );
+            wait  = std::max( wait, bucket->Wait() );
+        }
+    }
+
+    wait_ = std::min< Clock::duration >( wait, maxWait );
+    if( wait != Clock::duration::zero() )
+    {
+        return 0;
+    }
+
+    for( const auto& bucket : buckets_ )
+    {
+        if( bucket->Rate() )
+        {
+            bucket->Take( grant );
+        }
+    }
+    return std::max< size_t >( grant, 1 );
+}
+
+Shaper::Shaper( uint64_t globalRate, uint64_t userRate ) :
+    global_   { std::make_shared< Bucket >( globalRate ) },
+    userRate_ { userRate }
+{
+}
+
+Shaper::BucketPtr Shaper::User( const std::string& user )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    auto& bucket = users_[ user ];
+    if( ! bucket )
+    {
+        bucket = std::make_shared< Bucket >( UserRate() );
+    }
+    return bucket;
+}
+
+void Shaper::SetUserRate( uint64_t rate )
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    userRate_.store( rate, std::memory_order_relaxed );
+    for( auto& user : users_ )
+    {
+        user.second->SetRate( rate );
+    }
+}
+
+} // namespace ttf
@@ -0,0 +1,122 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fcpp
+{
+
+// Bandwidth shaping of data transfers with a hierarchy of token buckets: a
+// transfer draws from its session's bucket, its user's bucket and the
+// global one, and moves a chunk only once all of them allow it. Buckets
+// may run into debt, so a transfer always gets a large chunk (no tiny
+// buffers) and the next one simply waits a little longer. Each grant is
+// capped at the bucket's burst divided by the transfers drawing from it,
+// so concurrent transfers share a limit fairly. Nothing here blocks: a
+// transfer that has to wait is told for how long and gives its thread up
+// meanwhile (TransferExecutor::Defer).
+class Shaper
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    class Bucket
+    {
+    public:
+        // bytes per second, 0 means unlimited
+        explicit Bucket( uint64_t rate );
+
+        Bucket( const Bucket& ) = delete;
+        Bucket& operator=( const Bucket& ) = delete;
+
+        void SetRate( uint64_t rate );
+
+        uint64_t Rate() const
+        {
+            return rate_.load( std::memory_order_relaxed );
+        }
+
+    private:
+        friend class Shaper;
+
+        // largest grant for one of the transfers drawing from the bucket
+        size_t Share() const;
+        // how long until the bucket is out of debt, zero if it is now
+        Clock::duration Wait();
+        void Take( size_t bytes );
+        void Refill( Clock::time_point now );
+
+        std::atomic< uint64_t > rate_;
+        std::atomic< size_t >   active_;
+        std::mutex              mutex_;
+        double                  tokens_;
+        Clock::time_point       last_;
+    };
+
+    typedef std::shared_ptr< Bucket > BucketPtr;
+
+    // One transfer drawing from 'buckets' for as long as it lives.
+    class Transfer
+    {
+    public:
+        explicit Transfer( std::vector< BucketPtr > buckets );
+        ~Transfer();
+
+        Transfer( const Transfer& ) = delete;
+        Transfer& operator=( const Transfer& ) = delete;
+
+        // Returns how much of 'want' (at least one byte) the transfer may
+        // move now, 0 if it has to wait first.
+        size_t Acquire( size_t want );
+
+        // how long until Acquire() is worth calling again after it
+        // returned 0, zero after it granted something
+        Clock::duration Wait() const
+        {
+            return wait_;
+        }
+
+    private:
+        const std::vector< BucketPtr > buckets_;
+        Clock::duration                wait_;
+    };
+
+    // smallest grant of a limited bucket, keeps chunks big
+    static constexpr size_t minGrant = 64 * 1024;
+
+    Shaper( uint64_t globalRate, uint64_t userRate );
+
+    Shaper( const Shaper& ) = delete;
+    Shaper& operator=( const Shaper& ) = delete;
+
+    const BucketPtr& Global() const
+    {
+        return global_;
+    }
+
+    // the bucket shared by all sessions of 'user', created with the
+    // default per-user rate on first use
+    BucketPtr User( const std::string& user );
+
+    // changes the default per-user rate and every existing user bucket
+    void SetUserRate( uint64_t rate );
+
+    uint64_t UserRate() const
+    {
+        return userRate_.load( std::memory_order_relaxed );
+    }
+
+private:
+    const BucketPtr                     global_;
+    std::atomic< uint64_t >             userRate_;
+    std::mutex                          mutex_;
+    std::map< std::string, BucketPtr >  users_;
+};
+
+} // namespace ttf
@@ -0,0 +1,147 @@
+#include "TimerWheel.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace fcpp
+{
+
+boost::asio::io_service::id TimerWheel::id;
+constexpr TimerWheel::Clock::duration TimerWheel::resolution;
+
+TimerWheel::TimerWheel( boost::asio::io_service& io_service ) :
+    boost::asio::io_service::service( io_service ),
+    timer_  { io_service },
+    start_  ( Clock::now() ),
+    now_    {},
+    count_  {},
+    armed_  {},
+    slots_  ( levels * slots )
+{
+}
+
+void TimerWheel::shutdown_service()
+{
+    // handlers may own connections, drop them with the io_service
+    boost::system::error_code ignored;
+    timer_.cancel( ignored );
+    slots_.clear();
+    slots_.resize( levels * slots );
+    count_ = 0;
+}
+
+uint64_t TimerWheel::Elapsed() const
+{
+    return ( Clock::now() - start_ ) / resolution;
+}
+
+void TimerWheel::Schedule( Clock::duration delay, Handler handler )
+{
+    constexpr uint64_t maxTicks = ( uint64_t( 1 ) << ( levelBits * levels ) )
+                                  - 1;
+
+    uint64_t ticks = ( delay + resolution - Clock::duration( 1 ) )
+                     / resolution;
+    ticks = std::min( std::max< uint64_t >( ticks, 1 ), maxTicks );
+
+    if( 0 == count_ )
+    {
+        now_ = Elapsed(); // nothing to fire, catch up at once
+    }
+
+    Insert( Entry { now_ + ticks, std::move( handler ) } );
+    ++count_;
+
+    if( ! armed_ )
+    {
+        Arm();
+    }
+}
+
+// An entry goes to the lowest level whose digit is the highest one its
+// expiry differs from now in. It moves down a level each time its slot
+// comes around, and fires from level 0 exactly at its tick.
+void TimerWheel::Insert( Entry entry )
+{
+    unsigned level = 0;
+    while( level < levels - 1 &&
+           ( entry.expiry >> ( levelBits * ( level + 1 ) ) ) !=
+           ( now_ >> ( levelBits * ( level + 1 ) ) ) )
+    {
+        ++level;
+    }
+
+    auto index = ( entry.expiry >> ( levelBits * level ) ) & ( slots - 1 );
+    slots_[ level * slots + index ].push_back( std::move( entry ) );
+}
+
+void TimerWheel::Advance()
+{
+    ++now_;
+
+    // cascade the slots that came around, higher levels first so their
+    // entries can still land in a lower slot cascaded in the same tick
+    unsigned top = 0;
+    while( top + 1 < levels &&
+           0 == ( now_ & ( ( uint64_t( 1 ) << ( levelBits * ( top + 1 ) ) )
+                           - 1 ) ) )
+    {
+        ++top;
+    }
+    for( unsigned level = top; level > 0; --level )
+    {
+        auto index = ( now_ >> ( levelBits * level ) ) & ( slots - 1 );
+        Slot entries;
+        entries.swap( slots_[ level * slots + index ] );
+        for( auto& entry : entries )
+        {
+            Insert( std::move( entry ) );
+        }
+    }
+
+    // handlers may schedule again, so fire from a copy of the slot
+    Slot due;
+    due.swap( slots_[ now_ & ( slots - 1 ) ] );
+    count_ -= due.size();
+    for( auto& entry : due )
+    {
+        try
+        {
+            entry.handler();
+        }
+        catch( std::exception& ex )
+        {
+            PRINT_EX( ex );
+        }
+    }
+}
+
+void TimerWheel::Arm()
+{
+    armed_ = true;
+    timer_.expires_at( start_ + ( now_ + 1 ) * resolution );
+    timer_.async_wait( [ this ]( const boost::system::error_code& error ) {
+        if( ! error )
+        {
+            Tick();
+        }
+    } );
+}
+
+void TimerWheel::Tick()
+{
+    const auto target = Elapsed();
+    while( now_ < target && count_ > 0 )
+    {
+        Advance();
+    }
+
+    if( 0 == count_ )
+    {
+        armed_ = false;
+        return;
+    }
+    Arm();
+}
+
+} // namespace ttf
@@ -0,0 +1,69 @@
+#pragma once
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace fcpp
+{
+
+// Hierarchical timing wheel of one io_service, for the coarse timeouts of
+// many connections (idle sessions, PASV deadlines, stalled transfers).
+// Adding and firing a timer is O(1) however many there are, and a single
+// asio timer, armed only while timers are pending, drives the wheel.
+//
+// An asio service, so every io_service has exactly one:
+//     auto& wheel = boost::asio::use_service< TimerWheel >( io_service );
+// Schedule() must be called on the io_service's thread, handlers run there
+// too. Timers can't be cancelled: a handler checks whether what it guards
+// still exists (weak pointers) and does nothing otherwise.
+class TimerWheel : public boost::asio::io_service::service
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function< void() > Handler;
+
+    static boost::asio::io_service::id id;
+
+    // handlers run up to this much late
+    static constexpr Clock::duration resolution =
+                                        std::chrono::milliseconds( 100 );
+
+    explicit TimerWheel( boost::asio::io_service& io_service );
+
+    // calls 'handler' once 'delay' has passed, delays beyond what the wheel
+    // covers (about 19 days) are cut short
+    void Schedule( Clock::duration delay, Handler handler );
+
+private:
+    static constexpr unsigned levelBits = 6;
+    static constexpr size_t   slots     = size_t( 1 ) << levelBits;
+    static constexpr unsigned levels    = 4;
+
+    struct Entry
+    {
+        uint64_t    expiry; // in ticks
+        Handler     handler;
+    };
+    typedef std::vector< Entry > Slot;
+
+    void shutdown_service() override;
+
+    uint64_t Elapsed() const;
+    void Insert( Entry entry );
+    void Advance();
+    void Arm();
+    void Tick();
+
+    boost::asio::steady_timer   timer_;
+    const Clock::time_point     start_;
+    uint64_t                    now_;   // ticks since start_ processed
+    size_t                      count_; // pending timers
+    bool                        armed_;
+    std::vector< Slot >         slots_; // levels * slots, level 0 first
+};
+
+} // namespace ttf
@@ -0,0 +1,378 @@
+#include "FileDescriptor.hpp"
+#include "Transfer.hpp"
+#include "Utils.hpp"
+#include <boost/asio.hpp>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fcpp
+{
+namespace transfer
+{
+
+namespace
+{
+constexpr size_t sendfileChunk  = 1 << 20; // per sendfile(2) call
+constexpr size_t spliceChunk    = 1 << 20; // pipe capacity we ask for
+constexpr size_t fallbackBuffer = 1 << 17; // pread/read(2) fallback buffer
+
+static_assert( fallbackBuffer <= sendMemory &&
+               spliceChunk <= receiveMemory && fallbackBuffer <= spliceChunk,
+               "transfer buffers exceed what admission control accounts" );
+
+[[noreturn]] void ThrowError( const char* what, int err )
+{
+    auto msg = ( boost::format( "%s failed (%s)" )
+                                % what % ::strerror( err ) ).str();
+    switch( err )
+    {
+    case EPIPE:
+    case ECONNRESET:
+    case ENOTCONN:
+    case ETIMEDOUT:
+        throw DataConnectionError { msg };
+    default:
+        throw std::runtime_error { msg };
+    }
+}
+
+// asio may have switched the descriptor to non-blocking mode, wait until
+// the socket is ready again
+void WaitFor( int fd, short events )
+{
+    pollfd pfd {};
+    pfd.fd     = fd;
+    pfd.events = events;
+    while( -1 == ::poll( &pfd, 1, -1 ) )
+    {
+        if( errno != EINTR )
+        {
+            ThrowError( "poll", errno );
+        }
+    }
+}
+
+// how much of the next 'len' bytes may be moved now
+size_t Allow( const Throttle& throttle, size_t len )
+{
+    return throttle ? throttle( len ) : len;
+}
+
+uint64_t CopyFile( tcp::socket& socket, int fd, uint64_t offset,
+                   uint64_t count, const Throttle& throttle )
+{
+    std::vector< char > buf ( fallbackBuffer );
+    uint64_t sent = 0;
+
+    while( sent < count )
+    {
+        auto n = Allow( throttle, count - sent > buf.size() ? buf.size()
+                                                            : count - sent );
+        if( 0 == n )
+        {
+            break;
+        }
+        auto rd = ::pread( fd, buf.data(), n, offset + sent );
+        if( -1 == rd && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == rd )
+        {
+            ThrowError( "pread", errno );
+        }
+        if( 0 == rd )
+        {
+            break; // file was truncated while sending
+        }
+
+        boost::system::error_code error;
+        boost::asio::write( socket, boost::asio::buffer( buf.data(), rd ),
+                            error );
+        if( error )
+        {
+            throw DataConnectionError {
+                ( boost::format( "error transfering file: %s" )
+                                 % error.message()
+                ).str()
+            };
+        }
+        sent += rd;
+    }
+
+    return sent;
+}
+
+// reads up to 'len' bytes from a (possibly non-blocking) descriptor,
+// returns 0 on end of stream
+size_t ReadSome( int fd, char* data, size_t len )
+{
+    for( ;; )
+    {
+        auto n = ::read( fd, data, len );
+        if( n >= 0 )
+        {
+            return n;
+        }
+        if( errno == EAGAIN )
+        {
+            WaitFor( fd, POLLIN );
+        }
+        else if( errno != EINTR )
+        {
+            ThrowError( "read", errno );
+        }
+    }
+}
+
+// moves whatever is still sitting in the pipe to the file and returns the
+// number of bytes written
+uint64_t DrainPipe( int pipeFd, int fd, uint64_t offset, size_t pending )
+{
+    std::vector< char > buf ( fallbackBuffer );
+    uint64_t written = 0;
+
+    while( pending > 0 )
+    {
+        auto n = ReadSome( pipeFd, buf.data(),
+                           pending > buf.size() ? buf.size() : pending );
+        WriteAll( fd, buf.data(), n, offset + written );
+        written += n;
+        pending -= n;
+    }
+
+    return written;
+}
+
+uint64_t ReadToFile( int sock, int fd, uint64_t offset,
+                     const Throttle& throttle )
+{
+    std::vector< char > buf ( fallbackBuffer );
+    uint64_t received = 0;
+    size_t allowed = 0; // granted by the throttle but not received yet
+
+    for( ;; )
+    {
+        if( 0 == allowed )
+        {
+            allowed = Allow( throttle, buf.size() );
+            if( 0 == allowed )
+            {
+                break;
+            }
+        }
+
+        auto n = ReadSome( sock, buf.data(), allowed );
+        if( 0 == n )
+        {
+            break;
+        }
+        WriteAll( fd, buf.data(), n, offset + received );
+        received += n;
+        allowed  -= n;
+    }
+
+    return received;
+}
+} // namespace
+
+uint64_t SendFile( tcp::socket& socket, int fd, uint64_t offset,
+                   uint64_t count, const Throttle& throttle )
+{
+    const int sock = socket.native_handle();
+    uint64_t sent = 0;
+    size_t allowed = 0; // granted by the throttle but not sent yet
+
+    while( sent < count )
+    {
+        if( 0 == allowed )
+        {
+            allowed = Allow( throttle, count - sent > sendfileChunk
+                                            ? sendfileChunk : count - sent );
+            if( 0 == allowed )
+            {
+                break;
+            }
+        }
+
+        off_t off = offset + sent;
+        auto rc = ::sendfile( sock, fd, &off, allowed );
+        if( rc > 0 )
+        {
+            sent    += rc;
+            allowed -= rc;
+            continue;
+        }
+        if( 0 == rc )
+        {
+            break; // file was truncated while sending
+        }
+
+        switch( errno )
+        {
+        case EINTR:
+            break;
+        case EAGAIN:
+            WaitFor( sock, POLLOUT );
+            break;
+        case EINVAL:
+        case ENOSYS:
+        case EOPNOTSUPP:
+            if( 0 == sent )
+            {
+                return CopyFile( socket, fd, offset, count, throttle );
+            }
+            // fall through
+        default:
+            ThrowError( "sendfile", errno );
+        }
+    }
+
+    return sent;
+}
+
+uint64_t SendBuffer( tcp::socket& socket, const char* data, size_t len,
+                     const Throttle& throttle )
+{
+    size_t sent = 0;
+    while( sent < len )
+    {
+        auto n = Allow( throttle, len - sent );
+        if( 0 == n )
+        {
+            break;
+        }
+
+        boost::system::error_code error;
+        boost::asio::write( socket, boost::asio::buffer( data + sent, n ),
+                            error );
+        if( error )
+        {
+            throw DataConnectionError {
+                ( boost::format( "error transfering file: %s" )
+                                 % error.message()
+                ).str()
+            };
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+uint64_t ReceiveFile( tcp::socket& socket, int fd, uint64_t offset,
+                      const Throttle& throttle )
+{
+    const int sock = socket.native_handle();
+
+    int fds[ 2 ];
+    if( -1 == ::pipe2( fds, O_CLOEXEC ) )
+    {
+        return ReadToFile( sock, fd, offset, throttle );
+    }
+    FileDescriptor pipeRead { fds[ 0 ] };
+    FileDescriptor pipeWrite { fds[ 1 ] };
+
+    // a bigger pipe means fewer splice round trips, the default (64 KiB) is
+    // still fine if we are not allowed to grow it
+    ::fcntl( pipeWrite.get(), F_SETPIPE_SZ, spliceChunk );
+
+    uint64_t received = 0;
+    size_t allowed = 0; // granted by the throttle but not received yet
+    for( ;; )
+    {
+        // the pipe is empty here, nothing is lost by stopping
+        if( 0 == allowed )
+        {
+            allowed = Allow( throttle, spliceChunk );
+            if( 0 == allowed )
+            {
+                break;
+            }
+        }
+
+        auto in = ::splice( sock, nullptr, pipeWrite.get(), nullptr, allowed,
+                            SPLICE_F_MOVE | SPLICE_F_MORE );
+        if( 0 == in )
+        {
+            break;
+        }
+        if( -1 == in )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            if( errno == EAGAIN )
+            {
+                WaitFor( sock, POLLIN );
+                continue;
+            }
+            if( errno == EINVAL || errno == ENOSYS )
+            {
+                return received + ReadToFile( sock, fd, offset + received,
+                                              throttle );
+            }
+            ThrowError( "splice", errno );
+        }
+
+        allowed -= in;
+        size_t pending = in;
+        while( pending > 0 )
+        {
+            loff_t off = offset + received;
+            auto out = ::splice( pipeRead.get(), nullptr, fd, &off, pending,
+                                 SPLICE_F_MOVE );
+            if( out > 0 )
+            {
+                received += out;
+                pending  -= out;
+                continue;
+            }
+            if( -1 == out && errno == EINTR )
+            {
+                continue;
+            }
+            if( -1 == out && ( errno == EINVAL || errno == ENOSYS ) )
+            {
+                // the target filesystem can't splice, empty the pipe by hand
+                // and carry on without it
+                received += DrainPipe( pipeRead.get(), fd, offset + received,
+                                       pending );
+                return received + ReadToFile( sock, fd, offset + received,
+                                              throttle );
+            }
+            ThrowError( "splice", errno );
+        }
+    }
+
+    return received;
+}
+
+void WriteAll( int fd, const char* data, size_t len, uint64_t offset )
+{
+    while( len > 0 )
+    {
+        auto n = ::pwrite( fd, data, len, offset );
+        if( -1 == n && errno == EINTR )
+        {
+            continue;
+        }
+        if( -1 == n )
+        {
+            ThrowError( "pwrite", errno );
+        }
+        data   += n;
+        len    -= n;
+        offset += n;
+    }
+}
+
+} // namespace transfer
+} // namespace ttf
@@ -0,0 +1,60 @@
+#pragma once
+#include <boost/asio/ip/tcp.hpp>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+using boost::asio::ip::tcp;
+
+namespace fcpp
+{
+namespace transfer
+{
+
+// the client closed or reset the data connection mid transfer
+struct DataConnectionError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Most buffer memory (user space or pipe) a SendFile/ReceiveFile call holds,
+// for admission control.
+constexpr size_t sendMemory    = 1 << 17;
+constexpr size_t receiveMemory = 1 << 20;
+
+// Called before every chunk with the number of bytes about to be moved,
+// returns how many may be moved now. 0 stops the transfer early, the
+// functions below then return what they moved so far and are called again
+// for the rest later. Used for bandwidth shaping, see Shaper.
+typedef std::function< size_t( size_t ) > Throttle;
+
+// Sends 'count' bytes of the file 'fd' starting at 'offset' to the data
+// socket. The data is moved in-kernel with sendfile(2); filesystems that do
+// not support it fall back to pread(2) into a large user-space buffer.
+// Returns the number of bytes sent, fewer than 'count' if the file was
+// truncated meanwhile or 'throttle' stopped the transfer. Throws
+// DataConnectionError when the client goes away and std::runtime_error on
+// other failures.
+uint64_t SendFile( tcp::socket& socket, int fd, uint64_t offset,
+                   uint64_t count, const Throttle& throttle = Throttle() );
+
+// Sends 'len' bytes from memory to the data socket, returns and throws like
+// SendFile.
+uint64_t SendBuffer( tcp::socket& socket, const char* data, size_t len,
+                     const Throttle& throttle = Throttle() );
+
+// Receives data from the socket until the peer closes the connection, or
+// 'throttle' stops the transfer, and writes it to the file 'fd' starting at
+// 'offset'. The data is moved
+// socket -> pipe -> file with splice(2); where splice is unavailable it is
+// read in large chunks and written with pwrite(2).
+// Returns the number of bytes written, throws std::runtime_error on failure.
+uint64_t ReceiveFile( tcp::socket& socket, int fd, uint64_t offset,
+                      const Throttle& throttle = Throttle() );
+
+// writes all of 'data' to the file 'fd' at 'offset', throws
+// std::runtime_error on failure
+void WriteAll( int fd, const char* data, size_t len, uint64_t offset );
+
+} // namespace transfer
+} // namespace ttf
@@ -0,0 +1,220 @@
+#include "TransferExecutor.hpp"
+#include "Utils.hpp"
+#include <algorithm>
+#include <chrono>
+
+namespace fcpp
+{
+
+namespace
+{
+// memory is also freed by sessions ending, which nobody signals, so jobs
+// waiting for memory are retried at this interval
+constexpr auto memoryRetry = std::chrono::milliseconds( 50 );
+// and given up after this long, the client is better off trying again
+// than waiting on a server that is out of memory
+constexpr auto memoryWait = std::chrono::seconds( 30 );
+} // namespace
+
+thread_local TransferExecutor::Entry* TransferExecutor::running_ = nullptr;
+
+TransferExecutor::TransferExecutor( size_t threads, size_t maxQueued,
+                                    Admission& admission ) :
+    admission_ ( admission ),
+    maxQueued_ { maxQueued },
+    stopped_   {}
+{
+    for( size_t i = 0; i < std::max< size_t >( threads, 1 ); ++i )
+    {
+        threads_.emplace_back( &TransferExecutor::Run, this );
+    }
+}
+
+TransferExecutor::~TransferExecutor()
+{
+    Stop();
+}
+
+bool TransferExecutor::Post( const GroupPtr& group, Job job,
+                             size_t memory, Job expired )
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        if( stopped_ || queue_.size() >= maxQueued_ )
+        {
+            return false;
+        }
+        queue_.push_back( Entry { group, std::move( job ), memory,
+                                  std::move( expired ) } );
+    }
+
+    cond_.notify_one();
+    return true;
+}
+
+void TransferExecutor::Defer( Clock::duration delay )
+{
+    running_->resume = Clock::now() + delay;
+}
+
+void TransferExecutor::Stop()
+{
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        if( stopped_ )
+        {
+            return;
+        }
+        stopped_ = true;
+        queue_.clear();
+        for( auto& deferred : deferred_ )
+        {
+            admission_.Release( deferred.second.memory );
+            --deferred.second.group->active;
+        }
+        deferred_.clear();
+    }
+
+    cond_.notify_all();
+    for( auto& thread : threads_ )
+    {
+        thread.join();
+    }
+}
+
+void TransferExecutor::Run()
+{
+    std::unique_lock< std::mutex > lock { mutex_ };
+
+    for( ;; )
+    {
+        if( stopped_ )
+        {
+            return;
+        }
+
+        Entry entry;
+        auto now = Clock::now();
+        if( ! deferred_.empty() && deferred_.begin()->first <= now )
+        {
+            // a deferred job that is due, it still has slot and memory
+            entry = std::move( deferred_.begin()->second );
+            deferred_.erase( deferred_.begin() );
+        }
+        else
+        {
+            // oldest job whose session is still below its limit and whose
+            // buffers fit the memory budget
+            auto it = queue_.begin();
+            auto expired = queue_.end();
+            for( ; it != queue_.end(); ++it )
+            {
+                if( it->group->active >= it->group->limit )
+                {
+                    continue;
+                }
+                if( admission_.Reserve( it->memory ) )
+                {
+                    break;
+                }
+
+                if( it->starved == Clock::time_point() )
+                {
+                    it->starved = now;
+                }
+                else if( now - it->starved >= memoryWait &&
+                         expired == queue_.end() )
+                {
+                    expired = it;
+                }
+            }
+
+            if( it == queue_.end() && expired != queue_.end() )
+            {
+                Entry entry = std::move( *expired );
+                queue_.erase( expired );
+
+                lock.unlock();
+                LOG_WARN( "dropping a transfer that waited too long for "
+                          "memory" );
+                try
+                {
+                    entry.expired();
+                }
+                catch( std::exception& ex )
+                {
+                    PRINT_EX( ex );
+                }
+                entry = Entry();
+                lock.lock();
+                continue;
+            }
+
+            if( it == queue_.end() )
+            {
+                auto wake = Clock::time_point::max();
+                if( ! queue_.empty() )
+                {
+                    wake = now + memoryRetry;
+                }
+                if( ! deferred_.empty() )
+                {
+                    wake = std::min( wake, deferred_.begin()->first );
+                }
+
+                if( wake == Clock::time_point::max() )
+                {
+                    cond_.wait( lock );
+                }
+                else
+                {
+                    cond_.wait_until( lock, wake );
+                }
+                continue;
+            }
+
+            entry = std::move( *it );
+            queue_.erase( it );
+            ++entry.group->active;
+        }
+
+        lock.unlock();
+        entry.resume = Clock::time_point();
+        running_ = &entry;
+        try
+        {
+            entry.job();
+        }
+        catch( std::exception& ex )
+        {
+            PRINT_EX( ex );
+            entry.resume = Clock::time_point(); // failed, not deferred
+        }
+        running_ = nullptr;
+
+        if( entry.resume != Clock::time_point() )
+        {
+            lock.lock();
+            if( ! stopped_ )
+            {
+                auto resume = entry.resume;
+                deferred_.emplace( resume, std::move( entry ) );
+                // a thread waiting without a deadline has one now
+                cond_.notify_one();
+                continue;
+            }
+            lock.unlock();
+        }
+
+        entry.job = nullptr; // release captured sockets/connections unlocked
+        admission_.Release( entry.memory );
+        lock.lock();
+
+        --entry.group->active;
+        // another job of this session, or one waiting for memory, may have
+        // become runnable
+        cond_.notify_all();
+    }
+}
+
+} // namespace ttf
@@ -0,0 +1,91 @@
+#pragma once
+#include "Admission.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fcpp
+{
+
+// Fixed set of threads running data transfers (RETR, STOR..). The number of
+// threads bounds global transfer concurrency, jobs beyond that wait in a
+// bounded queue. Every session posts into its own Group which caps how many
+// of its transfers run at the same time, so one client can't occupy the
+// whole pool. A job starts only once the memory it needs fits the admission
+// budget; one that can't get it for a while is dropped. A job held back by
+// the bandwidth shaper defers itself rather than sleep on one of the
+// threads.
+class TransferExecutor
+{
+public:
+    typedef std::function< void() > Job;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Group
+    {
+        explicit Group( size_t maxActive ) :
+            limit  { maxActive },
+            active {}
+        {
+        }
+
+        const size_t limit;
+        size_t       active; // guarded by the executor mutex
+    };
+    typedef std::shared_ptr< Group > GroupPtr;
+
+    TransferExecutor( size_t threads, size_t maxQueued,
+                      Admission& admission );
+    ~TransferExecutor();
+
+    TransferExecutor( const TransferExecutor& ) = delete;
+    TransferExecutor& operator=( const TransferExecutor& ) = delete;
+
+    // Queues the job, which holds up to 'memory' bytes of buffers while it
+    // runs, returns false if the queue is full. If the memory isn't
+    // available for too long the job is dropped and 'expired' runs instead.
+    bool Post( const GroupPtr& group, Job job, size_t memory, Job expired );
+
+    // For the running job only: once it returns the job isn't finished but
+    // runs again, no sooner than 'delay' from now. It keeps its session
+    // slot and memory until then, not its thread.
+    void Defer( Clock::duration delay );
+
+    // finishes the running jobs, drops the queued ones and joins threads
+    void Stop();
+
+private:
+    struct Entry
+    {
+        GroupPtr            group;
+        Job                 job;
+        size_t              memory;
+        Job                 expired;
+        Clock::time_point   starved {}; // first found waiting for memory
+        Clock::time_point   resume {};  // set by Defer()
+    };
+
+    void Run();
+
+    // the entry the calling thread runs
+    static thread_local Entry*  running_;
+
+    std::mutex                  mutex_;
+    std::condition_variable     cond_;
+    Admission&                  admission_;
+    std::deque< Entry >         queue_;
+    // deferred jobs by when they run again, they hold slot and memory
+    std::multimap< Clock::time_point, Entry > deferred_;
+    const size_t                maxQueued_;
+    bool                        stopped_;
+    std::vector< std::thread >  threads_;
+};
+
+} // namespace ttf
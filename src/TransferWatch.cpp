@@ -0,0 +1,91 @@
+#include "TransferWatch.hpp"
+#include "Log.hpp"
+#include <cstddef>
+#include <linux/sockios.h>
+#include <linux/tcp.h> // tcp_info with the byte counters, unlike netinet's
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+namespace fcpp
+{
+
+namespace
+{
+// bytes acked by plus bytes received from the peer, false if the kernel
+// predates the counters (Linux 4.1) and progress can't be told
+bool Progress( int fd, uint64_t& bytes )
+{
+    tcp_info info {};
+    socklen_t len = sizeof( info );
+    if( -1 == ::getsockopt( fd, IPPROTO_TCP, TCP_INFO, &info, &len ) ||
+        len < offsetof( tcp_info, tcpi_bytes_received ) +
+              sizeof( info.tcpi_bytes_received ) )
+    {
+        return false;
+    }
+
+    bytes = info.tcpi_bytes_acked + info.tcpi_bytes_received;
+    return true;
+}
+
+// whether data we sent waits to be acked (or sent), then a transfer that
+// is throttled as well is still held up by the peer
+bool Unacked( int fd )
+{
+    int queued = 0;
+    return 0 == ::ioctl( fd, SIOCOUTQ, &queued ) && queued > 0;
+}
+} // namespace
+
+TransferWatch::TransferWatch( int fd ) :
+    fd_       { fd },
+    state_    { State::Queued },
+    measured_ {},
+    progress_ {},
+    throttled_ {}
+{
+}
+
+void TransferWatch::Started()
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    state_ = State::Running;
+}
+
+void TransferWatch::Throttled()
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    throttled_ = true;
+}
+
+TransferWatch::State TransferWatch::Check()
+{
+    std::lock_guard< std::mutex > lock { mutex_ };
+    if( state_ != State::Running )
+    {
+        return state_;
+    }
+
+    uint64_t progress = 0;
+    if( ! Progress( fd_, progress ) )
+    {
+        return state_;
+    }
+
+    if( measured_ && progress == progress_ &&
+        ( ! throttled_ || Unacked( fd_ ) ) )
+    {
+        LOG_WARN( "data connection stalled, closing it" );
+        ::shutdown( fd_, SHUT_RDWR );
+        state_ = State::Stalled;
+        return state_;
+    }
+
+    measured_  = true;
+    progress_  = progress;
+    throttled_ = false;
+    return state_;
+}
+
+} // namespace ttf
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+
+namespace fcpp
+{
+
+// Watches a data transfer running on the transfer threads from its
+// session's io_service. Progress is what the kernel reports for the data
+// connection (bytes acked by or received from the peer), so the data path
+// itself reports nothing. A transfer that made no progress between two
+// checks is stalled: its connection is shut down, which fails the blocked
+// sendfile/splice/write on the transfer thread. Time the bandwidth shaper
+// holds the transfer back moves no data either and isn't a stall.
+class TransferWatch
+{
+public:
+    enum class State
+    {
+        Queued,   // waiting for a transfer thread, never counts as a stall
+        Running,
+        Stalled,  // shut down by Check()
+        Done
+    };
+
+    // 'fd' is the data connection, it stays open until Finish()
+    explicit TransferWatch( int fd );
+
+    TransferWatch( const TransferWatch& ) = delete;
+    TransferWatch& operator=( const TransferWatch& ) = delete;
+
+    // transfer thread: the job started
+    void Started();
+
+    // transfer thread: the shaper holds the transfer back, the current
+    // check interval counts as progress unless sent data isn't acked
+    void Throttled();
+
+    // transfer thread: the job is over, 'close' closes the data connection
+    // while no Check() can touch its descriptor
+    template< typename Close >
+    void Finish( Close close )
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        state_ = State::Done;
+        close();
+    }
+
+    // io_service: compares progress with the previous call
+    State Check();
+
+    bool stalled() const
+    {
+        std::lock_guard< std::mutex > lock { mutex_ };
+        return state_ == State::Stalled;
+    }
+
+private:
+    mutable std::mutex  mutex_;
+    const int           fd_;
+    State               state_;
+    bool                measured_; // progress_ holds a reading
+    uint64_t            progress_;
+    bool                throttled_; // since the last Check()
+};
+
+} // namespace ttf
@@ -1,17 +1,15 @@
 #pragma once
 
-#include <iostream>
+#include "Log.hpp"
 #include <string>
 
-#define PRINT_EX(ex) ( std::cerr << "error in " << __FILE__  \
-                                  << ":"  << __LINE__ \
-                                  << " " << __func__ \
-                                  << " :: " << ex.what() << "\n" )
+#define PRINT_EX(ex) LOG_ERROR( "error in %s:%d %s :: %s", \
+                                __FILE__, __LINE__, __func__, \
+                                ( ex ).what() )
 
-#define PRINT_ERR_STR(s) ( std::cerr << "error in " << __FILE__  \
-                                    << ":"  << __LINE__ \
-                                    << " " << __func__ \
-                                    << " :: " << ( s ) << "\n" )
+#define PRINT_ERR_STR(s) LOG_ERROR( "error in %s:%d %s :: %s", \
+                                    __FILE__, __LINE__, __func__, \
+                                    ::fcpp::log::CStr( s ) )
 
 namespace fcpp
 {
@@ -1,23 +1,53 @@
+#include "Config.hpp"
+#include "Context.hpp"
+#include "IoServicePool.hpp"
+#include "Log.hpp"
+#include "Metrics.hpp"
 #include "Server.hpp"
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
-#include <iostream>
+#include <memory>
+#include <vector>
 
-int main( int, const char* [] )
+int main( int argc, const char* argv[] )
 {
+    fcpp::log::Flusher logFlusher;
+
     try
     {
-        srand( static_cast< unsigned int >( time( NULL ) ) );
+        // sendfile/splice into a socket the client already closed must fail
+        // with EPIPE rather than kill the server
+        ::signal( SIGPIPE, SIG_IGN );
+
+        fcpp::Context context { fcpp::Config::Parse( argc, argv ) };
+        const auto& config = context.config;
+
+        fcpp::log::threshold = config.logLevel;
+        LOG_INFO( "Starting ftp server on port %u with %zu reactor thread(s)",
+                  config.port, config.threads );
+
+        fcpp::IoServicePool pool { config.threads, config.pinThreads };
 
-        constexpr uint16_t port = 8021;
+        std::vector< std::unique_ptr< fcpp::TcpServer > > servers;
+        for( size_t i = 0; i < ( config.reusePort ? pool.size() : 1 ); ++i )
+        {
+            servers.emplace_back(
+                    new fcpp::TcpServer { context, pool, pool.at( i ) } );
+        }
 
-        std::cout << "Starting ftp server on port " << port << "\n";
+        std::unique_ptr< fcpp::MetricsFile > metricsFile;
+        if( ! config.metricsFile.empty() )
+        {
+            metricsFile.reset( new fcpp::MetricsFile {
+                pool.at( 0 ), context.metrics, config.metricsFile,
+                config.metricsInterval
+            } );
+        }
 
-        boost::asio::io_service io_service;
-        fcpp::TcpServer server { io_service, "127.0.0.1", port };
-        io_service.run();
+        pool.run();
 
-        std::cout << "done, exiting FTP server\n";
+        LOG_INFO( "done, exiting FTP server" );
     }
     catch ( std::exception& e )
     {